@@ -8,6 +8,8 @@ import argparse
 import concurrent.futures
 import logging
 
+import profiles
+
 logging.basicConfig(
     level=logging.INFO,
     format="%(asctime)s - %(levelname)s - %(message)s",
@@ -23,6 +25,9 @@ else:
     MOON_HOME = Path(MOON_HOME)
 VERSION = "0.1.26"
 
+# Kinds of queries vendored next to each binding, as named in tree-sitter.json.
+QUERY_KINDS = ["highlights", "locals", "tags"]
+
 
 class Metadata:
     version: str
@@ -55,6 +60,9 @@ class Grammar:
     files: list[str]
     external_files: list[Path]
     file_types: list[str]
+    queries: dict[str, list[Path]]
+    profile: str
+    corpus: list[Path]
 
     def __init__(
         self,
@@ -63,6 +71,7 @@ class Grammar:
         metadata: Metadata,
         external_files: list[Path] = [],
         file_types: list[str] = [],
+        queries: dict[str, list[Path]] = {},
     ):
         self.name = name.replace("-", "_")
         self.path = path
@@ -71,6 +80,10 @@ class Grammar:
         self.files = []
         self.external_files = external_files
         self.file_types = file_types
+        self.queries = queries
+        language = profiles.load_languages().get(self.name, {})
+        self.profile = language.get("profile", "default")
+        self.corpus = profiles.corpus_files(language)
 
     def tree_sitter_generate(self):
         subprocess.run(
@@ -106,15 +119,19 @@ class Grammar:
         }
         destination.write_text(json.dumps(moon_mod_json, indent=2) + "\n")
 
-    def generate_moon_pkg_to(self, destination: Path):
+    def generate_moon_pkg_to(self, destination: Path, march: str | None = None):
         native_stub_list = ", ".join(f'"{stub}"' for stub in self.stubs)
+        flags = " ".join(profiles.profile_flags(self.profile, march))
+        link = ""
+        if flags:
+            link = f'  link: {{ native: {{ "stub-cc-flags": "{flags}" }} }},\n'
         content = f"""import {{
   "tonyfettes/tree_sitter_language",
 }}
 
 options(
   native_stub: [ {native_stub_list} ],
-  "supported-targets": "+native",
+{link}  "supported-targets": "+native",
   targets: {{ "binding.mbt": [ "native" ] }},
 )
 """
@@ -174,7 +191,17 @@ pub extern "c" fn language() -> @tree_sitter_language.Language = "{function_name
         expanded_lines = process_file(original_lines)
         (destination / file).write_text("\n".join(expanded_lines))
 
-    def generate_binding_to(self, destination: Path):
+    def copy_queries_to(self, destination: Path):
+        """Concatenate the query files of each kind into one file per kind, so
+        that the query benchmark finds them next to the binding."""
+        for kind, files in self.queries.items():
+            if not files:
+                continue
+            destination.mkdir(parents=True, exist_ok=True)
+            content = "\n".join(file.read_text() for file in files)
+            (destination / f"{kind}.scm").write_text(content)
+
+    def generate_binding_to(self, destination: Path, march: str | None = None):
         self.tree_sitter_generate()
         if destination.exists():
             shutil.rmtree(destination)
@@ -191,6 +218,7 @@ pub extern "c" fn language() -> @tree_sitter_language.Language = "{function_name
             self.perform_c_include_to(
                 destination, file.relative_to(destination), relocations
             )
+        self.copy_queries_to(destination / "queries")
         # Scan destination to collect stubs and files after all copying is done
         self.stubs = []
         self.files = []
@@ -209,7 +237,29 @@ pub extern "c" fn language() -> @tree_sitter_language.Language = "{function_name
         self.generate_moon_mod_json_to(
             destination / "moon.mod.json", VERSION, wasm=wasm_path.name
         )
-        self.generate_moon_pkg_to(destination / "moon.pkg")
+        self.generate_moon_pkg_to(destination / "moon.pkg", march)
+
+    def build_shared_library_to(
+        self,
+        binding: Path,
+        destination: Path,
+        march: str | None = None,
+        pgo: bool = False,
+    ) -> Path:
+        """Compile the generated sources into a grammar shared library that can
+        be loaded at runtime with `Language::load`, with the flags of the
+        grammar's build profile."""
+        output = destination / (
+            f"tree_sitter_{self.name}{profiles.shared_library_suffix()}"
+        )
+        return profiles.build_shared(
+            binding,
+            self.name,
+            output,
+            self.profile,
+            march=march,
+            corpus=self.corpus if pgo else [],
+        )
 
 
 def _load_grammars_lock() -> dict:
@@ -270,7 +320,30 @@ def git_clean(path: Path):
         raise RuntimeError(f"Failed to clean git repository at {path}: {e}")
 
 
-def generate_binding(project: Path, bindings: Path):
+def grammar_query_files(
+    project: Path, grammar_path: Path, grammar_dict: dict, kind: str
+) -> list[Path]:
+    """Get the query files of `kind` listed in tree-sitter.json, relative to the
+    project, or the conventional queries/<kind>.scm of the grammar."""
+    listed = grammar_dict.get(kind, [])
+    if isinstance(listed, str):
+        listed = [listed]
+    if listed:
+        return [project / file for file in listed if (project / file).exists()]
+    for root in (grammar_path, project):
+        default = root / "queries" / f"{kind}.scm"
+        if default.exists():
+            return [default]
+    return []
+
+
+def generate_binding(
+    project: Path,
+    bindings: Path,
+    shared: Path | None = None,
+    march: str | None = None,
+    pgo: bool = False,
+):
     if not project.exists():
         raise FileNotFoundError(f"{project} does not exist")
 
@@ -329,6 +402,10 @@ def generate_binding(project: Path, bindings: Path):
                         f"{external_file_path} does not exist, but is listed in tree-sitter.json"
                     )
                 grammar_external_files.append(external_file_path)
+            grammar_queries = {
+                kind: grammar_query_files(project, grammar_path, grammar_dict, kind)
+                for kind in QUERY_KINDS
+            }
             grammar_dict = Grammar(
                 name=grammar_name,
                 path=grammar_path,
@@ -336,11 +413,12 @@ def generate_binding(project: Path, bindings: Path):
                 file_types=(
                     grammar_dict["file-types"] if "file-types" in grammar_dict else []
                 ),
+                queries=grammar_queries,
                 metadata=metadata,
             )
             binding_root: Path = (bindings / f"tree_sitter_{grammar_dict.name}").resolve()
             logger.info(f"Generating binding for {grammar_name}")
-            grammar_dict.generate_binding_to(binding_root)
+            grammar_dict.generate_binding_to(binding_root, march)
 
             logger.info(f"Building binding for {grammar_name}")
             subprocess.run(
@@ -349,6 +427,12 @@ def generate_binding(project: Path, bindings: Path):
                 check=True,
                 capture_output=True,
             )
+            if shared is not None:
+                logger.info(f"Building shared library for {grammar_name}")
+                library = grammar_dict.build_shared_library_to(
+                    binding_root, shared, march=march, pgo=pgo
+                )
+                logger.info(f"Built {library}")
     except Exception as e:
         logger.error(f"Error generating binding for {project}: {e}")
         raise e
@@ -357,6 +441,20 @@ def generate_binding(project: Path, bindings: Path):
         git_clean(project)
 
 
+def build_bundled_shared(
+    names: list[str], bindings: Path, shared: Path, march: str | None = None
+):
+    """Build grammars whose bindings are already generated under `bindings` as
+    shared libraries, without regenerating them from their sources."""
+    languages = profiles.load_languages()
+    for name in names:
+        binding = bindings / f"tree_sitter_{name}"
+        output = shared / f"tree_sitter_{name}{profiles.shared_library_suffix()}"
+        profile = languages.get(name, {}).get("profile", "default")
+        profiles.build_shared(binding, name, output, profile, march=march)
+        logger.info(f"Built {output}")
+
+
 def publish_languages(bindings: Path):
     for lang_dir in sorted(bindings.iterdir()):
         if not lang_dir.is_dir():
@@ -394,6 +492,36 @@ def main():
         default=os.cpu_count(),
         help="Number of worker threads to use (default: number of CPU cores)",
     )
+    parser.add_argument(
+        "--shared",
+        type=Path,
+        nargs="?",
+        const=Path("target", "grammars"),
+        default=None,
+        help="Also build each grammar as a shared library loadable with "
+        "Language::load, into the given directory (default: target/grammars)",
+    )
+    parser.add_argument(
+        "--march",
+        default=None,
+        help="Target architecture for grammars with the speed profile, "
+        "passed to the compiler as -march",
+    )
+    parser.add_argument(
+        "--pgo",
+        action="store_true",
+        help="Build shared libraries of speed grammars with profile-guided "
+        "optimization, trained on their corpus (requires --shared)",
+    )
+    parser.add_argument(
+        "--bundled",
+        nargs="+",
+        metavar="LANGUAGE",
+        default=None,
+        help="Only build the shared libraries of these bundled languages from "
+        "their bindings in src/languages, without regenerating them "
+        "(requires --shared)",
+    )
     parser.add_argument(
         "--publish",
         action="store_true",
@@ -403,13 +531,21 @@ def main():
 
     bindings = Path("src", "languages")
 
+    if args.bundled:
+        if args.shared is None:
+            parser.error("--bundled requires --shared")
+        build_bundled_shared(args.bundled, bindings, args.shared, args.march)
+        return
+
     # Create a thread pool executor
     with concurrent.futures.ThreadPoolExecutor(max_workers=args.workers) as executor:
         futures = []
         if args.path:
             # Process each path provided
             for p in args.path:
-                future = executor.submit(generate_binding, p, bindings)
+                future = executor.submit(
+                    generate_binding, p, bindings, args.shared, args.march, args.pgo
+                )
                 futures.append((p, future))
         else:
             # Multiple grammars case (default behavior when no path is specified)
@@ -419,7 +555,12 @@ def main():
 
                 # Submit each grammar to the thread pool
                 future = executor.submit(
-                    generate_binding, path_item, bindings
+                    generate_binding,
+                    path_item,
+                    bindings,
+                    args.shared,
+                    args.march,
+                    args.pgo,
                 )
                 futures.append((path_item, future))
 
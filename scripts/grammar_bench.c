@@ -0,0 +1,84 @@
+// Parse files with a grammar loaded from a shared library, and report the
+// number of bytes parsed and the time spent parsing them.
+//
+// Usage: grammar_bench <library> <symbol> <iterations> <file>...
+//
+// Used by scripts/profiles.py, both to train profile-guided builds and to
+// measure parse throughput.
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <tree_sitter/api.h>
+
+static char *
+read_file(const char *path, size_t *length) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  char *content = malloc(size > 0 ? (size_t)size : 1);
+  *length = fread(content, 1, size > 0 ? (size_t)size : 0, file);
+  fclose(file);
+  return content;
+}
+
+static double
+now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 4) {
+    fprintf(
+      stderr, "usage: %s <library> <symbol> <iterations> <file>...\n", argv[0]
+    );
+    return 2;
+  }
+  void *library = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+  if (!library) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+  const TSLanguage *(*language)(void);
+  *(void **)&language = dlsym(library, argv[2]);
+  if (!language) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+  TSParser *parser = ts_parser_new();
+  if (!ts_parser_set_language(parser, language())) {
+    fprintf(stderr, "incompatible language version\n");
+    return 1;
+  }
+  int iterations = atoi(argv[3]);
+  size_t bytes = 0;
+  double seconds = 0;
+  for (int i = 4; i < argc; i++) {
+    size_t length = 0;
+    char *content = read_file(argv[i], &length);
+    if (!content) {
+      fprintf(stderr, "cannot read %s\n", argv[i]);
+      return 1;
+    }
+    for (int iteration = 0; iteration < iterations; iteration++) {
+      double start = now();
+      TSTree *tree =
+        ts_parser_parse_string(parser, NULL, content, (uint32_t)length);
+      seconds += now() - start;
+      ts_tree_delete(tree);
+      bytes += length;
+    }
+    free(content);
+  }
+  ts_parser_delete(parser);
+  printf("%zu %.9f\n", bytes, seconds);
+  return 0;
+}
@@ -0,0 +1,295 @@
+#!/usr/bin/env python3
+"""Build profiles for the C sources of grammars.
+
+Each language in grammars.json may choose a profile:
+
+  default  the flags of the package that compiles the grammar
+  size     -Os, for grammars that are rarely used
+  speed    -O3, plus -march when one is given, for hot grammars
+
+A speed grammar with a training `corpus` (globs relative to the repository
+root) is also built with profile-guided optimization when it is compiled as a
+shared library: an instrumented build parses the corpus first, and the
+recorded profile drives the final build.
+
+`python scripts/profiles.py bench` builds the bundled grammars as shared
+libraries under every profile and prints their size against their parse
+throughput on their corpus, or on their sample in src/bench/corpus when they
+have none. It needs the tree-sitter submodule, unless `--sizes-only`
+skips parsing. scripts/profiles.md records the last measured table.
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+from pathlib import Path
+
+PROFILE_FLAGS = {"default": [], "size": ["-Os"], "speed": ["-O3"]}
+
+GRAMMARS_JSON = Path("grammars.json")
+LANGUAGES = Path("src", "languages")
+TREE_SITTER = Path("src", "tree-sitter", "lib")
+DRIVER = Path("scripts", "grammar_bench.c")
+SAMPLES = Path("src", "bench", "corpus")
+BUILD = Path("target", "profiles")
+
+
+def shared_library_suffix() -> str:
+    if sys.platform == "win32":
+        return ".dll"
+    if sys.platform == "darwin":
+        return ".dylib"
+    return ".so"
+
+
+def profile_flags(profile: str, march: str | None = None) -> list[str]:
+    flags = list(PROFILE_FLAGS[profile])
+    if profile == "speed" and march:
+        flags.append(f"-march={march}")
+    return flags
+
+
+def load_languages() -> dict[str, dict]:
+    """Get the `languages` entries of every grammar in grammars.json."""
+    languages: dict[str, dict] = {}
+    for grammar in json.loads(GRAMMARS_JSON.read_text()).values():
+        languages.update(grammar.get("languages", {}))
+    return languages
+
+
+def corpus_files(entry: dict) -> list[Path]:
+    files: set[Path] = set()
+    for pattern in entry.get("corpus", []):
+        files.update(path for path in Path(".").glob(pattern) if path.is_file())
+    return sorted(files)
+
+
+def sample_corpus(name: str) -> list[Path]:
+    """Get the benchmark sample of a grammar, so that grammars without a
+    `corpus` in grammars.json are measured on the same input as the parse
+    benchmark."""
+    path = SAMPLES / f"{name}.txt"
+    return [path] if path.exists() else []
+
+
+def compiler() -> str:
+    return os.getenv("CC", "clang" if sys.platform == "win32" else "cc")
+
+
+def is_clang() -> bool:
+    result = subprocess.run(
+        [compiler(), "--version"], check=True, capture_output=True, text=True
+    )
+    return "clang" in result.stdout
+
+
+def compile_shared(
+    binding: Path, output: Path, flags: list[str], objects: Path
+) -> Path:
+    """Compile every C file of a binding into `objects`, then link them into a
+    shared library. Object paths are kept stable so that GCC finds the profile
+    of each object when it is rebuilt with -fprofile-use."""
+    objects.mkdir(parents=True, exist_ok=True)
+    output.parent.mkdir(parents=True, exist_ok=True)
+    pic = [] if sys.platform == "win32" else ["-fPIC"]
+    linked = []
+    for source in sorted(binding.glob("*.c")):
+        object_file = (objects / source.with_suffix(".o").name).resolve()
+        subprocess.run(
+            [
+                compiler(),
+                "-c",
+                "-std=c11",
+                *pic,
+                "-I",
+                str(binding),
+                *flags,
+                str(source),
+                "-o",
+                str(object_file),
+            ],
+            check=True,
+            capture_output=True,
+        )
+        linked.append(str(object_file))
+    subprocess.run(
+        [compiler(), "-shared", *flags, *linked, "-o", str(output)],
+        check=True,
+        capture_output=True,
+    )
+    return output
+
+
+def language_symbol(binding: Path) -> str:
+    match = re.search(r'= "(\w+)"', (binding / "binding.mbt").read_text())
+    if match is None:
+        raise ValueError(f"Could not find the language symbol of {binding}")
+    return match.group(1)
+
+
+def build_driver(build: Path) -> Path:
+    driver = build / "grammar_bench"
+    if driver.exists() and driver.stat().st_mtime >= DRIVER.stat().st_mtime:
+        return driver
+    build.mkdir(parents=True, exist_ok=True)
+    subprocess.run(
+        [
+            compiler(),
+            "-O2",
+            "-std=gnu11",
+            "-I",
+            str(TREE_SITTER / "include"),
+            "-I",
+            str(TREE_SITTER / "src"),
+            str(DRIVER),
+            str(TREE_SITTER / "src" / "lib.c"),
+            "-ldl",
+            "-o",
+            str(driver),
+        ],
+        check=True,
+        capture_output=True,
+    )
+    return driver
+
+
+def run_driver(
+    driver: Path, library: Path, symbol: str, iterations: int, files: list[Path]
+) -> tuple[int, float]:
+    result = subprocess.run(
+        [str(driver), str(library.resolve()), symbol, str(iterations)]
+        + [str(file) for file in files],
+        check=True,
+        capture_output=True,
+        text=True,
+    )
+    parsed, seconds = result.stdout.split()
+    return int(parsed), float(seconds)
+
+
+def pgo_flags(
+    binding: Path, name: str, flags: list[str], corpus: list[Path], build: Path
+) -> list[str]:
+    """Train an instrumented build of a grammar on its corpus, and return the
+    flags that compile it with the recorded profile."""
+    data = (build / "pgo" / name).resolve()
+    if data.exists():
+        shutil.rmtree(data)
+    data.mkdir(parents=True)
+    clang = is_clang()
+    if clang:
+        generate = [f"-fprofile-instr-generate={data}/%p.profraw"]
+    else:
+        generate = [f"-fprofile-generate={data}"]
+    instrumented = data / f"instrumented{shared_library_suffix()}"
+    compile_shared(binding, instrumented, flags + generate, data / "objects")
+    symbol = language_symbol(binding)
+    run_driver(build_driver(build), instrumented, symbol, 1, corpus)
+    if clang:
+        profile = data / f"{name}.profdata"
+        subprocess.run(
+            ["llvm-profdata", "merge", "-o", str(profile)]
+            + [str(raw) for raw in data.glob("*.profraw")],
+            check=True,
+            capture_output=True,
+        )
+        return [f"-fprofile-instr-use={profile}"]
+    return [
+        f"-fprofile-use={data}",
+        "-fprofile-partial-training",
+        "-Wno-missing-profile",
+    ]
+
+
+def build_shared(
+    binding: Path,
+    name: str,
+    output: Path,
+    profile: str,
+    march: str | None = None,
+    corpus: list[Path] = [],
+    build: Path = BUILD,
+) -> Path:
+    """Build a grammar as a shared library with the flags of its profile,
+    using profile-guided optimization for speed grammars with a corpus."""
+    flags = profile_flags(profile, march) or ["-O2"]
+    if profile == "speed" and corpus:
+        flags += pgo_flags(binding, name, flags, corpus, build)
+        objects = (build / "pgo" / name / "objects").resolve()
+    else:
+        objects = (build / "objects" / name / profile).resolve()
+    return compile_shared(binding, output, flags, objects)
+
+
+def bench(args):
+    languages = load_languages()
+    build = BUILD
+    driver = None if args.sizes_only else build_driver(build)
+    names = args.languages or sorted(
+        path.name.removeprefix("tree_sitter_")
+        for path in LANGUAGES.iterdir()
+        if (path / "binding.mbt").exists()
+    )
+    print("| grammar | profile | size (KiB) | throughput (MiB/s) |")
+    print("| --- | --- | ---: | ---: |")
+    for name in names:
+        binding = LANGUAGES / f"tree_sitter_{name}"
+        if not (binding / "parser.c").exists():
+            sys.exit(f"{binding} has no parser.c, run scripts/generate.py first")
+        symbol = language_symbol(binding)
+        corpus = corpus_files(languages.get(name, {})) or sample_corpus(name)
+        if not corpus:
+            sys.exit(f"{name} has neither a corpus nor a sample in {SAMPLES}")
+        variants = [("-O2", ["-O2"], False), ("size", ["-Os"], False)]
+        variants.append(("speed", profile_flags("speed", args.march), False))
+        variants.append(("speed+pgo", profile_flags("speed", args.march), True))
+        for label, flags, pgo in variants:
+            if pgo and driver is None:
+                # Training needs the driver, so the row stays unmeasured.
+                print(f"| {name} | {label} | - | - |")
+                continue
+            output = build / "bench" / f"{name}-{label}{shared_library_suffix()}"
+            objects = (build / "objects" / name / label).resolve()
+            if pgo:
+                flags = flags + pgo_flags(binding, name, flags, corpus, build)
+                objects = (build / "pgo" / name / "objects").resolve()
+            compile_shared(binding, output, flags, objects)
+            size = output.stat().st_size / 1024
+            throughput = "-"
+            if driver is not None:
+                parsed, seconds = run_driver(
+                    driver, output, symbol, args.iterations, corpus
+                )
+                throughput = f"{parsed / seconds / (1 << 20):.2f}"
+            print(f"| {name} | {label} | {size:.0f} | {throughput} |")
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter
+    )
+    subparsers = parser.add_subparsers(dest="command", required=True)
+    bench_parser = subparsers.add_parser(
+        "bench", help="Print object size against parse throughput per grammar"
+    )
+    bench_parser.add_argument(
+        "languages", nargs="*", help="Grammars to benchmark (default: all bundled)"
+    )
+    bench_parser.add_argument("--march", default=None)
+    bench_parser.add_argument("--iterations", type=int, default=20)
+    bench_parser.add_argument(
+        "--sizes-only",
+        action="store_true",
+        help="Only build and measure sizes, without the tree-sitter submodule",
+    )
+    bench_parser.set_defaults(handler=bench)
+    args = parser.parse_args()
+    args.handler(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Generate the file type dispatch table of `LanguageRegistry`.
+
+The table is read from the `languages` of each grammar in grammars.json and
+written as a perfect hash table to src/language_registry_table.mbt.
+Every file type and interpreter gets its own slot, found with two hashes and
+one string comparison at runtime.
+"""
+
+import argparse
+import json
+from pathlib import Path
+
+GRAMMARS_JSON = Path("grammars.json")
+OUTPUT = Path("src", "language_registry_table.mbt")
+
+# Keys for shebang interpreters are prefixed so that they never collide with a
+# file type of the same name.
+INTERPRETER_PREFIX = "#!"
+
+MASK = 0xFFFFFFFF
+
+
+def registry_hash(key: str, seed: int) -> int:
+    """FNV-1a over code points, with the seed folded into the offset basis.
+
+    Must stay in sync with `registry_hash` in language_registry.native.mbt.
+    """
+    value = (0x811C9DC5 ^ ((seed * 0x9E3779B9) & MASK)) & MASK
+    for char in key:
+        value ^= ord(char)
+        value = (value * 0x01000193) & MASK
+    return value
+
+
+def collect(grammars: dict) -> tuple[dict[str, str], list[tuple[str, str]]]:
+    keys: dict[str, str] = {}
+    first_lines: list[tuple[str, str]] = []
+
+    def add(key: str, language: str):
+        if key in keys and keys[key] != language:
+            raise ValueError(
+                f"{key!r} is claimed by both {keys[key]} and {language}"
+            )
+        keys[key] = language
+
+    for grammar in grammars.values():
+        for language, entry in grammar.get("languages", {}).items():
+            for file_type in entry.get("file-types", []):
+                add(file_type, language)
+            for interpreter in entry.get("interpreters", []):
+                add(INTERPRETER_PREFIX + interpreter, language)
+            for prefix in entry.get("first-lines", []):
+                first_lines.append((prefix, language))
+    return keys, first_lines
+
+
+def perfect_hash(keys: list[str]) -> tuple[list[int], list[str]]:
+    """Hash and displace: keys are grouped into buckets by a first hash, and
+    each bucket, largest first, gets the first seed that sends all of its keys
+    to free slots."""
+    size = max(1, len(keys) + len(keys) // 4)
+    bucket_count = max(1, len(keys) // 2)
+    buckets: list[list[str]] = [[] for _ in range(bucket_count)]
+    for key in keys:
+        buckets[registry_hash(key, 0) % bucket_count].append(key)
+    seeds = [0] * bucket_count
+    slots: list[str] = [""] * size
+    order = sorted(range(bucket_count), key=lambda i: -len(buckets[i]))
+    for index in order:
+        bucket = buckets[index]
+        if not bucket:
+            continue
+        seed = 1
+        while True:
+            positions = [registry_hash(key, seed) % size for key in bucket]
+            if len(set(positions)) == len(positions) and all(
+                slots[position] == "" for position in positions
+            ):
+                break
+            seed += 1
+        seeds[index] = seed
+        for key, position in zip(bucket, positions):
+            slots[position] = key
+    return seeds, slots
+
+
+def moonbit_string(value: str) -> str:
+    return json.dumps(value)
+
+
+def render(keys: dict[str, str], first_lines: list[tuple[str, str]]) -> str:
+    seeds, slots = perfect_hash(sorted(keys))
+    lines = [
+        "// Code generated by scripts/registry.py from grammars.json. DO NOT EDIT.",
+        "",
+        "///|",
+        "let registry_seeds : FixedArray[UInt] = [",
+    ]
+    lines += [f"  {seed}," for seed in seeds]
+    lines += ["]", "", "///|", "let registry_keys : FixedArray[String] = ["]
+    lines += [f"  {moonbit_string(slot)}," for slot in slots]
+    lines += ["]", "", "///|", "let registry_languages : FixedArray[String] = ["]
+    lines += [f"  {moonbit_string(keys.get(slot, ''))}," for slot in slots]
+    lines += [
+        "]",
+        "",
+        "///|",
+        "let registry_first_lines : FixedArray[(String, String)] = [",
+    ]
+    lines += [
+        f"  ({moonbit_string(prefix)}, {moonbit_string(language)}),"
+        for prefix, language in first_lines
+    ]
+    lines += ["]", ""]
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--output", type=Path, default=OUTPUT)
+    args = parser.parse_args()
+    grammars = json.loads(GRAMMARS_JSON.read_text())
+    keys, first_lines = collect(grammars)
+    args.output.write_text(render(keys, first_lines))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Measure cold start of a native binary that links every bundled grammar.
+
+Builds src/bench/startup in release mode, then spawns it repeatedly, once with
+languages created lazily through `LanguageRegistry` and once with all of them
+created up front (`--eager`), and reports the wall time from spawn to exit.
+"""
+
+import argparse
+import statistics
+import subprocess
+import time
+from pathlib import Path
+
+
+def build() -> Path:
+    subprocess.run(["moon", "build", "--target", "native", "--release"], check=True)
+    candidates = list(
+        Path("_build", "native", "release", "build").rglob("startup.exe")
+    )
+    if not candidates:
+        raise FileNotFoundError("could not find the built startup.exe")
+    return max(candidates, key=lambda path: path.stat().st_mtime)
+
+
+def measure(binary: Path, args: list[str], runs: int) -> list[float]:
+    # One unmeasured run to warm the page cache.
+    subprocess.run([binary, *args], check=True, capture_output=True)
+    timings = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run([binary, *args], check=True, capture_output=True)
+        timings.append((time.perf_counter() - start) * 1000)
+    return timings
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--runs", type=int, default=50)
+    parser.add_argument(
+        "--binary",
+        type=Path,
+        default=None,
+        help="Use an already built startup binary instead of building one",
+    )
+    args = parser.parse_args()
+    binary = args.binary if args.binary is not None else build()
+    print(f"{'mode':<8} {'min':>9} {'median':>9} {'max':>9}")
+    for mode, mode_args in [("lazy", []), ("eager", ["--eager"])]:
+        timings = measure(binary, mode_args, args.runs)
+        print(
+            f"{mode:<8} {min(timings):>7.2f}ms {statistics.median(timings):>7.2f}ms"
+            f" {max(timings):>7.2f}ms"
+        )
+
+
+if __name__ == "__main__":
+    main()
@@ -1,14 +1,67 @@
 #!/usr/bin/env python3
-"""Run moon check and then ASAN-enabled tests via run-asan.py."""
+"""Run moon check, build the loader fixture, run ASAN-enabled tests via
+run-asan.py, and then run the tests of the binding once more with the FFI
+counters of -DMOONBIT_TS_STATS compiled in."""
 
+import importlib.util
+import os
 import subprocess
 import sys
 from pathlib import Path
 
+STATS_FLAG = "-DMOONBIT_TS_STATS"
+
+
+def run_stats_tests(repo_root: Path) -> int:
+    """Add -DMOONBIT_TS_STATS to the stub-cc-flags of src/moon.pkg, run its
+    tests, and restore the file. MOONBIT_TS_STATS tells the tests that the
+    counters must be enabled."""
+    spec = importlib.util.spec_from_file_location(
+        "run_asan", repo_root / "scripts" / "run-asan.py"
+    )
+    run_asan = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(run_asan)
+    pkg = repo_root / "src" / "moon.pkg"
+    original = pkg.read_text(encoding="utf-8")
+    text = run_asan._ensure_native_block(original)
+    existing = run_asan._find_string_value_in_native(text, "stub-cc-flags")
+    flags = f"{existing} {STATS_FLAG}" if existing else STATS_FLAG
+    pkg.write_text(
+        run_asan._replace_or_insert_in_native(text, "stub-cc-flags", flags),
+        encoding="utf-8",
+    )
+    try:
+        result = subprocess.run(
+            [
+                "moon",
+                "test",
+                "--target",
+                "native",
+                "--package",
+                "tonyfettes/tree_sitter",
+            ],
+            cwd=repo_root,
+            env={**os.environ, "MOONBIT_TS_STATS": "1"},
+        )
+        return result.returncode
+    finally:
+        pkg.write_text(original, encoding="utf-8")
+
 
 def main():
     repo_root = Path(__file__).resolve().parent.parent
     subprocess.run(["moon", "check", "--target", "native"], check=True, cwd=repo_root)
+    subprocess.run(
+        [
+            sys.executable,
+            str(repo_root / "scripts" / "generate.py"),
+            "--shared",
+            "--bundled",
+            "json",
+        ],
+        check=True,
+        cwd=repo_root,
+    )
     result = subprocess.run(
         [
             sys.executable,
@@ -20,7 +73,9 @@ def main():
         ],
         cwd=repo_root,
     )
-    sys.exit(result.returncode)
+    if result.returncode != 0:
+        sys.exit(result.returncode)
+    sys.exit(run_stats_tests(repo_root))
 
 
 if __name__ == "__main__":
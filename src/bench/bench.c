@@ -0,0 +1,197 @@
+#include <moonbit.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#include <sys/resource.h>
+#else
+#include <malloc.h>
+#include <sys/resource.h>
+#endif
+
+// Defined by the tree-sitter runtime that is compiled into the main package.
+extern void
+ts_set_allocator(
+  void *(*new_malloc)(size_t),
+  void *(*new_calloc)(size_t, size_t),
+  void *(*new_realloc)(void *, size_t),
+  void (*new_free)(void *)
+);
+
+// Allocations made by tree-sitter, counted by the allocator installed with
+// `moonbit_bench_track_allocations`. Block sizes are read back from the system
+// allocator rather than stored in a header, so blocks allocated before the
+// allocator was installed can still be freed through it.
+typedef struct MoonBitBenchAllocations {
+  uint64_t count;
+  uint64_t bytes;
+  int64_t live;
+  int64_t peak;
+} MoonBitBenchAllocations;
+
+static MoonBitBenchAllocations moonbit_bench_allocations = {0};
+
+static inline size_t
+moonbit_bench_block_size(void *block) {
+#ifdef _WIN32
+  return _msize(block);
+#elif defined(__APPLE__)
+  return malloc_size(block);
+#else
+  return malloc_usable_size(block);
+#endif
+}
+
+static inline void *
+moonbit_bench_allocated(void *block) {
+  if (block) {
+    size_t size = moonbit_bench_block_size(block);
+    moonbit_bench_allocations.count++;
+    moonbit_bench_allocations.bytes += size;
+    moonbit_bench_allocations.live += (int64_t)size;
+    if (moonbit_bench_allocations.live > moonbit_bench_allocations.peak) {
+      moonbit_bench_allocations.peak = moonbit_bench_allocations.live;
+    }
+  }
+  return block;
+}
+
+static inline void
+moonbit_bench_freed(void *block) {
+  if (block) {
+    moonbit_bench_allocations.live -= (int64_t)moonbit_bench_block_size(block);
+  }
+}
+
+static void *
+moonbit_bench_malloc(size_t size) {
+  return moonbit_bench_allocated(malloc(size));
+}
+
+static void *
+moonbit_bench_calloc(size_t count, size_t size) {
+  return moonbit_bench_allocated(calloc(count, size));
+}
+
+static void *
+moonbit_bench_realloc(void *block, size_t size) {
+  moonbit_bench_freed(block);
+  return moonbit_bench_allocated(realloc(block, size));
+}
+
+static void
+moonbit_bench_free(void *block) {
+  moonbit_bench_freed(block);
+  free(block);
+}
+
+MOONBIT_FFI_EXPORT
+void
+moonbit_bench_track_allocations(void) {
+  ts_set_allocator(
+    moonbit_bench_malloc, moonbit_bench_calloc, moonbit_bench_realloc,
+    moonbit_bench_free
+  );
+}
+
+MOONBIT_FFI_EXPORT
+void
+moonbit_bench_reset_allocations(void) {
+  moonbit_bench_allocations.count = 0;
+  moonbit_bench_allocations.bytes = 0;
+  moonbit_bench_allocations.peak = moonbit_bench_allocations.live;
+}
+
+// The counters are returned as `[count, bytes, live, peak]`.
+MOONBIT_FFI_EXPORT
+uint64_t *
+moonbit_bench_allocations_get(void) {
+  uint64_t *result = (uint64_t *)moonbit_make_int64_array(4, 0);
+  result[0] = moonbit_bench_allocations.count;
+  result[1] = moonbit_bench_allocations.bytes;
+  result[2] = (uint64_t)moonbit_bench_allocations.live;
+  result[3] = (uint64_t)moonbit_bench_allocations.peak;
+  return result;
+}
+
+MOONBIT_FFI_EXPORT
+uint64_t
+moonbit_bench_clock_nanos(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000u +
+         (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000u /
+           frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+// Peak resident set size of the process, in bytes.
+MOONBIT_FFI_EXPORT
+uint64_t
+moonbit_bench_peak_rss(void) {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return (uint64_t)counters.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return (uint64_t)usage.ru_maxrss;
+#else
+  return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_bench_is_null(void *object) {
+  return object == NULL;
+}
+
+// Read the whole file at the NUL-terminated `path`, or return NULL if it cannot
+// be read.
+MOONBIT_FFI_EXPORT
+moonbit_bytes_t
+moonbit_bench_read_file(moonbit_bytes_t path) {
+  FILE *file = fopen((const char *)path, "rb");
+  if (!file) {
+    return NULL;
+  }
+  if (fseek(file, 0, SEEK_END) != 0) {
+    fclose(file);
+    return NULL;
+  }
+  long size = ftell(file);
+  if (size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+    fclose(file);
+    return NULL;
+  }
+  moonbit_bytes_t content = moonbit_make_bytes((int32_t)size, 0);
+  size_t read = fread(content, 1, (size_t)size, file);
+  fclose(file);
+  if (read != (size_t)size) {
+    moonbit_decref(content);
+    return NULL;
+  }
+  return content;
+}
@@ -1,10 +1,24 @@
 #include "tree-sitter#lib#src#lib.c"
 #include <assert.h>
+#include <inttypes.h>
 #include <moonbit.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifdef DEBUG
 #include <stdio.h>
@@ -25,6 +39,98 @@
 
 #define moonbit_ts_ignore(...) ((void)(__VA_ARGS__))
 
+// Instrumentation counters, compiled in only with -DMOONBIT_TS_STATS.
+//
+// Every exported `moonbit_ts_*` function counts its calls with
+// `MOONBIT_TS_STATS_CALL`, and every allocation site counts its allocations
+// with `MOONBIT_TS_STATS_ALLOCATION`. Each use of the macros owns a static
+// counter that links itself into `moonbit_ts_counters` the first time it is
+// hit, so there is no central list of counters to keep in sync. Without
+// MOONBIT_TS_STATS the macros expand to nothing.
+//
+// The counters are updated with the GCC/Clang atomic builtins, or with the
+// Interlocked functions on Windows, where MSVC has no such builtins.
+#ifdef MOONBIT_TS_STATS
+#if !defined(_WIN32) && !defined(__GNUC__) && !defined(__clang__)
+#error "MOONBIT_TS_STATS requires atomic builtins or the Interlocked API"
+#endif
+
+typedef struct MoonBitTSCounter {
+  const char *kind;
+  const char *function;
+  int line;
+  int registered;
+  uint64_t count;
+  struct MoonBitTSCounter *next;
+} MoonBitTSCounter;
+
+static MoonBitTSCounter *moonbit_ts_counters = NULL;
+
+static void
+moonbit_ts_counter_hit(MoonBitTSCounter *counter) {
+#ifdef _WIN32
+  if (!InterlockedExchange((volatile LONG *)&counter->registered, 1)) {
+    MoonBitTSCounter *head;
+    do {
+      head = (MoonBitTSCounter *)InterlockedCompareExchangePointer(
+        (PVOID volatile *)&moonbit_ts_counters, NULL, NULL
+      );
+      counter->next = head;
+    } while (InterlockedCompareExchangePointer(
+               (PVOID volatile *)&moonbit_ts_counters, counter, head
+             ) != head);
+  }
+  InterlockedIncrement64((volatile LONG64 *)&counter->count);
+#else
+  if (!__atomic_exchange_n(&counter->registered, 1, __ATOMIC_ACQ_REL)) {
+    counter->next = __atomic_load_n(&moonbit_ts_counters, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(
+      &moonbit_ts_counters, &counter->next, counter, true, __ATOMIC_RELEASE,
+      __ATOMIC_ACQUIRE
+    )) {
+    }
+  }
+  __atomic_fetch_add(&counter->count, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static MoonBitTSCounter *
+moonbit_ts_counters_head(void) {
+#ifdef _WIN32
+  return (MoonBitTSCounter *)InterlockedCompareExchangePointer(
+    (PVOID volatile *)&moonbit_ts_counters, NULL, NULL
+  );
+#else
+  return __atomic_load_n(&moonbit_ts_counters, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static uint64_t
+moonbit_ts_counter_take(MoonBitTSCounter *counter, int32_t reset) {
+#ifdef _WIN32
+  volatile LONG64 *count = (volatile LONG64 *)&counter->count;
+  return (uint64_t)(reset ? InterlockedExchange64(count, 0)
+                          : InterlockedCompareExchange64(count, 0, 0));
+#else
+  return reset ? __atomic_exchange_n(&counter->count, 0, __ATOMIC_RELAXED)
+               : __atomic_load_n(&counter->count, __ATOMIC_RELAXED);
+#endif
+}
+
+#define MOONBIT_TS_STATS_COUNT(kind)                                           \
+  do {                                                                         \
+    static MoonBitTSCounter moonbit_ts_counter = {                             \
+      kind, __func__, __LINE__, 0, 0, NULL                                     \
+    };                                                                         \
+    moonbit_ts_counter_hit(&moonbit_ts_counter);                               \
+  } while (0)
+#define MOONBIT_TS_STATS_CALL() MOONBIT_TS_STATS_COUNT("call")
+#define MOONBIT_TS_STATS_ALLOCATION() MOONBIT_TS_STATS_COUNT("allocation")
+#else
+#define MOONBIT_TS_STATS_CALL() ((void)0)
+#define MOONBIT_TS_STATS_ALLOCATION() ((void)0)
+#endif
+
 MOONBIT_FFI_EXPORT
 void *
 moonbit_c_null(void) {
@@ -40,15 +146,26 @@ moonbit_c_is_null(void *ptr) {
 MOONBIT_FFI_EXPORT
 const TSLanguage *
 moonbit_ts_language_copy(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_copy(self);
 }
 
 MOONBIT_FFI_EXPORT
 void
 moonbit_ts_language_delete(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
   ts_language_delete(self);
 }
 
+// Languages that are not loaded from Wasm are never freed, so their address
+// identifies them for the lifetime of the process.
+MOONBIT_FFI_EXPORT
+uint64_t
+moonbit_ts_language_address(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
+  return (uint64_t)(uintptr_t)self;
+}
+
 static inline int32_t
 moonbit_uint_to_int(uint32_t value) {
   assert(value <= INT32_MAX);
@@ -58,12 +175,14 @@ moonbit_uint_to_int(uint32_t value) {
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_language_symbol_count(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_symbol_count(self);
 }
 
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_language_state_count(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_state_count(self);
 }
 
@@ -76,6 +195,7 @@ moonbit_ts_language_symbol_for_name(
   moonbit_bytes_t name,
   int32_t is_named
 ) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t length = Moonbit_array_length(name);
   TSSymbol symbol =
     ts_language_symbol_for_name(self, (const char *)name, length, is_named);
@@ -85,6 +205,7 @@ moonbit_ts_language_symbol_for_name(
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_language_field_count(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_field_count(self);
 }
 
@@ -102,6 +223,7 @@ moonbit_make_bytes_sz(size_t size, int value) {
 MOONBIT_FFI_EXPORT
 const char *
 moonbit_ts_language_field_name_for_id(const TSLanguage *self, TSFieldId id) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_field_name_for_id(self, id);
 }
 
@@ -111,6 +233,7 @@ moonbit_ts_language_field_id_for_name(
   const TSLanguage *self,
   moonbit_bytes_t name
 ) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t length = Moonbit_array_length(name);
   TSFieldId id =
     ts_language_field_id_for_name(self, (const char *)name, length);
@@ -120,8 +243,10 @@ moonbit_ts_language_field_id_for_name(
 MOONBIT_FFI_EXPORT
 TSSymbol *
 moonbit_ts_language_supertypes(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t length;
   const TSSymbol *supertypes = ts_language_supertypes(self, &length);
+  MOONBIT_TS_STATS_ALLOCATION();
   TSSymbol *copy = (TSSymbol *)moonbit_make_bytes_sz(length, 0);
   memcpy(copy, supertypes, length * sizeof(TSSymbol));
   return copy;
@@ -130,8 +255,10 @@ moonbit_ts_language_supertypes(const TSLanguage *self) {
 MOONBIT_FFI_EXPORT
 TSSymbol *
 moonbit_ts_language_subtypes(const TSLanguage *self, TSSymbol supertype) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t length;
   const TSSymbol *subtypes = ts_language_subtypes(self, supertype, &length);
+  MOONBIT_TS_STATS_ALLOCATION();
   TSSymbol *copy = (TSSymbol *)moonbit_make_bytes_sz(length, 0);
   memcpy(copy, subtypes, length * sizeof(TSSymbol));
   return copy;
@@ -140,6 +267,7 @@ moonbit_ts_language_subtypes(const TSLanguage *self, TSSymbol supertype) {
 MOONBIT_FFI_EXPORT
 const char *
 moonbit_ts_language_symbol_name(const TSLanguage *self, TSSymbol symbol) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_symbol_name(self, symbol);
 }
 
@@ -148,25 +276,30 @@ static_assert_type_equal(TSSymbolType, uint32_t);
 MOONBIT_FFI_EXPORT
 TSSymbolType
 moonbit_ts_language_symbol_type(const TSLanguage *self, TSSymbol symbol) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_symbol_type(self, symbol);
 }
 
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_language_version(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_version(self);
 }
 
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_language_abi_version(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_abi_version(self);
 }
 
 MOONBIT_FFI_EXPORT
 moonbit_bytes_t
 moonbit_ts_language_metadata(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
   const TSLanguageMetadata *metadata = ts_language_metadata(self);
+  MOONBIT_TS_STATS_ALLOCATION();
   moonbit_bytes_t bytes = moonbit_make_bytes(3, 0);
   bytes[0] = metadata->major_version;
   bytes[1] = metadata->minor_version;
@@ -183,15 +316,500 @@ moonbit_ts_language_next_state(
   TSStateId state,
   TSSymbol symbol
 ) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_next_state(self, state, symbol);
 }
 
 MOONBIT_FFI_EXPORT
 const char *
 moonbit_ts_language_name(const TSLanguage *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_language_name(self);
 }
 
+// Grammar libraries opened by `moonbit_ts_library_open`. They are never
+// closed, as the languages they define may be referenced from anywhere.
+typedef struct MoonBitTSLibrary {
+  char *path;
+#ifdef _WIN32
+  HMODULE handle;
+#else
+  void *handle;
+#endif
+} MoonBitTSLibrary;
+
+static MoonBitTSLibrary *moonbit_ts_libraries = NULL;
+static uint32_t moonbit_ts_library_count = 0;
+static uint32_t moonbit_ts_library_capacity = 0;
+static char moonbit_ts_library_error_message[512] = "";
+
+static inline MoonBitTSLibrary *
+moonbit_ts_library_find(const char *path) {
+  for (uint32_t i = 0; i < moonbit_ts_library_count; i++) {
+    if (strcmp(moonbit_ts_libraries[i].path, path) == 0) {
+      return &moonbit_ts_libraries[i];
+    }
+  }
+  return NULL;
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_library_open(moonbit_bytes_t path) {
+  MOONBIT_TS_STATS_CALL();
+  const char *name = (const char *)path;
+  if (moonbit_ts_library_find(name)) {
+    return true;
+  }
+#ifdef _WIN32
+  HMODULE handle = LoadLibraryA(name);
+  if (!handle) {
+    snprintf(
+      moonbit_ts_library_error_message,
+      sizeof(moonbit_ts_library_error_message),
+      "LoadLibrary failed with error %lu", (unsigned long)GetLastError()
+    );
+    return false;
+  }
+#else
+  void *handle = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    const char *message = dlerror();
+    snprintf(
+      moonbit_ts_library_error_message,
+      sizeof(moonbit_ts_library_error_message), "%s",
+      message ? message : "dlopen failed"
+    );
+    return false;
+  }
+#endif
+  if (moonbit_ts_library_count == moonbit_ts_library_capacity) {
+    moonbit_ts_library_capacity =
+      moonbit_ts_library_capacity ? moonbit_ts_library_capacity * 2 : 8;
+    MOONBIT_TS_STATS_ALLOCATION();
+    moonbit_ts_libraries = (MoonBitTSLibrary *)realloc(
+      moonbit_ts_libraries,
+      moonbit_ts_library_capacity * sizeof(MoonBitTSLibrary)
+    );
+  }
+  size_t length = strlen(name);
+  MOONBIT_TS_STATS_ALLOCATION();
+  char *copy = (char *)malloc(length + 1);
+  memcpy(copy, name, length + 1);
+  moonbit_ts_libraries[moonbit_ts_library_count++] =
+    (MoonBitTSLibrary){.path = copy, .handle = handle};
+  return true;
+}
+
+// Look up the language function `symbol` in a library that was opened by
+// `moonbit_ts_library_open`, and return a new reference to its language.
+MOONBIT_FFI_EXPORT
+const TSLanguage *
+moonbit_ts_library_language(moonbit_bytes_t path, moonbit_bytes_t symbol) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSLibrary *library = moonbit_ts_library_find((const char *)path);
+  if (!library) {
+    return NULL;
+  }
+  typedef const TSLanguage *(*MoonBitTSLanguageFunction)(void);
+  MoonBitTSLanguageFunction function;
+#ifdef _WIN32
+  function = (MoonBitTSLanguageFunction)(void (*)(void))GetProcAddress(
+    library->handle, (const char *)symbol
+  );
+#else
+  *(void **)&function = dlsym(library->handle, (const char *)symbol);
+#endif
+  if (!function) {
+    return NULL;
+  }
+  return ts_language_copy(function());
+}
+
+MOONBIT_FFI_EXPORT
+moonbit_bytes_t
+moonbit_ts_library_error(void) {
+  MOONBIT_TS_STATS_CALL();
+  size_t length = strlen(moonbit_ts_library_error_message);
+  MOONBIT_TS_STATS_ALLOCATION();
+  moonbit_bytes_t bytes = moonbit_make_bytes_sz(length, 0);
+  memcpy(bytes, moonbit_ts_library_error_message, length);
+  return bytes;
+}
+
+static inline bool
+moonbit_ts_starts_with(const char *string, const char *prefix) {
+  return strncmp(string, prefix, strlen(prefix)) == 0;
+}
+
+static inline uint64_t
+moonbit_ts_log_field_or(
+  const char *buffer,
+  const char *field,
+  uint64_t missing
+) {
+  const char *value = strstr(buffer, field);
+  if (!value) {
+    return missing;
+  }
+  return strtoull(value + strlen(field), NULL, 10);
+}
+
+static inline uint64_t
+moonbit_ts_log_field(const char *buffer, const char *field) {
+  return moonbit_ts_log_field_or(buffer, field, 0);
+}
+
+// A log buffer keeps the most recent parser log events as fixed-size binary
+// records in a ring, so that logging never calls back into MoonBit. Each
+// record is four words: `(log_type << 8) | event`, the parse state, the
+// symbol and the byte offset of the lexer, with UINT32_MAX for a missing
+// state or symbol. When the ring is full, the oldest record is overwritten and
+// counted as dropped.
+//
+// The ring is reference counted: one reference is held by the MoonBit object,
+// and one by each parser it is attached to, through a `MoonBitTSLogSink`.
+typedef enum MoonBitTSLogEvent {
+  MoonBitTSLogEventOther,
+  MoonBitTSLogEventProcess,
+  MoonBitTSLogEventLex,
+  MoonBitTSLogEventLexedLookahead,
+  MoonBitTSLogEventShift,
+  MoonBitTSLogEventReduce,
+  MoonBitTSLogEventAccept,
+  MoonBitTSLogEventReuseNode,
+  MoonBitTSLogEventDetectError,
+  MoonBitTSLogEventRecover,
+  MoonBitTSLogEventSkipToken,
+  MoonBitTSLogEventConsume,
+  MoonBitTSLogEventSkip,
+} MoonBitTSLogEvent;
+
+typedef struct MoonBitTSLogRecord {
+  uint32_t kind;
+  uint32_t state;
+  uint32_t symbol;
+  uint32_t byte;
+} MoonBitTSLogRecord;
+
+// The records of a log buffer. A ring may be shared by several parsers, some
+// of them parsing on background threads, so its records are guarded by
+// `lock`, and it is reference counted atomically by the buffer and the sinks
+// of those parsers.
+typedef struct MoonBitTSLogRing {
+  MoonBitTSLogRecord *records;
+  uint32_t capacity;
+  uint32_t start;
+  uint32_t length;
+  uint64_t dropped;
+  bool lex;
+  volatile int32_t references;
+#ifdef _WIN32
+  SRWLOCK lock;
+#else
+  pthread_mutex_t lock;
+#endif
+} MoonBitTSLogRing;
+
+typedef struct MoonBitTSLogBuffer {
+  MoonBitTSLogRing *ring;
+} MoonBitTSLogBuffer;
+
+// Symbol names in log messages are mapped back to symbols through an open
+// addressing table of every symbol of a language, hidden ones included, as
+// `ts_language_symbol_for_name` only finds visible symbols and scans them all.
+typedef struct MoonBitTSSymbolTableEntry {
+  uint32_t hash;
+  uint32_t symbol;
+} MoonBitTSSymbolTableEntry;
+
+typedef struct MoonBitTSSymbolTable {
+  const TSLanguage *language;
+  uint32_t mask;
+  MoonBitTSSymbolTableEntry entries[];
+} MoonBitTSSymbolTable;
+
+// What a structured logger needs to know to classify the messages of a parser.
+// The symbol table is built for the parser's language on first use, and is
+// owned by the context.
+typedef struct MoonBitTSLogContext {
+  TSParser *parser;
+  MoonBitTSSymbolTable *symbols;
+} MoonBitTSLogContext;
+
+typedef struct MoonBitTSLogSink {
+  MoonBitTSLogRing *ring;
+  MoonBitTSLogContext context;
+} MoonBitTSLogSink;
+
+static inline void
+moonbit_ts_log_ring_lock(MoonBitTSLogRing *ring) {
+#ifdef _WIN32
+  AcquireSRWLockExclusive(&ring->lock);
+#else
+  pthread_mutex_lock(&ring->lock);
+#endif
+}
+
+static inline void
+moonbit_ts_log_ring_unlock(MoonBitTSLogRing *ring) {
+#ifdef _WIN32
+  ReleaseSRWLockExclusive(&ring->lock);
+#else
+  pthread_mutex_unlock(&ring->lock);
+#endif
+}
+
+static inline void
+moonbit_ts_log_ring_retain(MoonBitTSLogRing *ring) {
+#ifdef _WIN32
+  InterlockedIncrement((volatile LONG *)&ring->references);
+#else
+  __atomic_fetch_add(&ring->references, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void
+moonbit_ts_log_ring_release(MoonBitTSLogRing *ring) {
+#ifdef _WIN32
+  int32_t references =
+    InterlockedDecrement((volatile LONG *)&ring->references);
+#else
+  int32_t references =
+    __atomic_sub_fetch(&ring->references, 1, __ATOMIC_ACQ_REL);
+#endif
+  if (references == 0) {
+#ifndef _WIN32
+    pthread_mutex_destroy(&ring->lock);
+#endif
+    free(ring->records);
+    free(ring);
+  }
+}
+
+static inline void
+moonbit_ts_log_buffer_delete(void *object) {
+  MoonBitTSLogBuffer *buffer = (MoonBitTSLogBuffer *)object;
+  moonbit_ts_log_ring_release(buffer->ring);
+}
+
+static inline uint32_t
+moonbit_ts_symbol_table_hash(const char *name, size_t length) {
+  uint32_t hash = 0x811C9DC5u;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t)name[i]) * 0x01000193u;
+  }
+  return hash;
+}
+
+// Add `symbol` under its name. When several symbols share a name, a named
+// symbol wins over the others, and otherwise the first one is kept.
+static void
+moonbit_ts_symbol_table_insert(MoonBitTSSymbolTable *table, TSSymbol symbol) {
+  const TSLanguage *language = table->language;
+  const char *name = ts_language_symbol_name(language, symbol);
+  if (!name) {
+    return;
+  }
+  uint32_t hash = moonbit_ts_symbol_table_hash(name, strlen(name));
+  for (uint32_t slot = hash & table->mask;; slot = (slot + 1) & table->mask) {
+    MoonBitTSSymbolTableEntry *entry = &table->entries[slot];
+    if (entry->symbol == UINT32_MAX) {
+      entry->hash = hash;
+      entry->symbol = symbol;
+      return;
+    }
+    TSSymbol other = (TSSymbol)entry->symbol;
+    if (entry->hash == hash &&
+        strcmp(ts_language_symbol_name(language, other), name) == 0) {
+      if (ts_language_symbol_type(language, other) != TSSymbolTypeRegular &&
+          ts_language_symbol_type(language, symbol) == TSSymbolTypeRegular) {
+        entry->symbol = symbol;
+      }
+      return;
+    }
+  }
+}
+
+static MoonBitTSSymbolTable *
+moonbit_ts_symbol_table_new(const TSLanguage *language) {
+  uint32_t count = ts_language_symbol_count(language);
+  uint32_t capacity = 16;
+  while (capacity < 2 * (count + 2)) {
+    capacity *= 2;
+  }
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSSymbolTable *table = (MoonBitTSSymbolTable *)malloc(
+    sizeof(MoonBitTSSymbolTable) + capacity * sizeof(MoonBitTSSymbolTableEntry)
+  );
+  table->language = language;
+  table->mask = capacity - 1;
+  for (uint32_t i = 0; i < capacity; i++) {
+    table->entries[i].symbol = UINT32_MAX;
+  }
+  for (uint32_t symbol = 0; symbol < count; symbol++) {
+    moonbit_ts_symbol_table_insert(table, (TSSymbol)symbol);
+  }
+  moonbit_ts_symbol_table_insert(table, ts_builtin_sym_error);
+  moonbit_ts_symbol_table_insert(table, ts_builtin_sym_error_repeat);
+  return table;
+}
+
+static uint32_t
+moonbit_ts_symbol_table_find(
+  const MoonBitTSSymbolTable *table,
+  const char *name,
+  size_t length
+) {
+  uint32_t hash = moonbit_ts_symbol_table_hash(name, length);
+  for (uint32_t slot = hash & table->mask;; slot = (slot + 1) & table->mask) {
+    const MoonBitTSSymbolTableEntry *entry = &table->entries[slot];
+    if (entry->symbol == UINT32_MAX) {
+      return UINT32_MAX;
+    }
+    if (entry->hash != hash) {
+      continue;
+    }
+    const char *candidate =
+      ts_language_symbol_name(table->language, (TSSymbol)entry->symbol);
+    if (strncmp(candidate, name, length) == 0 && candidate[length] == '\0') {
+      return entry->symbol;
+    }
+  }
+}
+
+static uint32_t
+moonbit_ts_log_symbol(
+  MoonBitTSLogContext *context,
+  const char *message,
+  const char *field,
+  const char *terminator
+) {
+  const char *name = strstr(message, field);
+  if (!name) {
+    return UINT32_MAX;
+  }
+  name += strlen(field);
+  const char *end = terminator ? strstr(name, terminator) : NULL;
+  size_t length = end ? (size_t)(end - name) : strlen(name);
+  const TSLanguage *language = ts_parser_language(context->parser);
+  if (!language) {
+    return UINT32_MAX;
+  }
+  if (!context->symbols || context->symbols->language != language) {
+    free(context->symbols);
+    context->symbols = moonbit_ts_symbol_table_new(language);
+  }
+  return moonbit_ts_symbol_table_find(context->symbols, name, length);
+}
+
+// Classify a log message by its prefix, storing the symbol it mentions, if
+// any, into `symbol`.
+static MoonBitTSLogEvent
+moonbit_ts_log_classify(
+  MoonBitTSLogContext *context,
+  TSLogType log_type,
+  const char *message,
+  uint32_t *symbol
+) {
+  *symbol = UINT32_MAX;
+  if (log_type == TSLogTypeLex) {
+    if (moonbit_ts_starts_with(message, "consume")) {
+      return MoonBitTSLogEventConsume;
+    }
+    if (moonbit_ts_starts_with(message, "skip")) {
+      return MoonBitTSLogEventSkip;
+    }
+    return MoonBitTSLogEventOther;
+  }
+  if (moonbit_ts_starts_with(message, "process version:")) {
+    return MoonBitTSLogEventProcess;
+  }
+  if (moonbit_ts_starts_with(message, "lex_internal") ||
+      moonbit_ts_starts_with(message, "lex_external")) {
+    return MoonBitTSLogEventLex;
+  }
+  if (moonbit_ts_starts_with(message, "lexed_lookahead")) {
+    *symbol = moonbit_ts_log_symbol(context, message, "sym:", ", size:");
+    return MoonBitTSLogEventLexedLookahead;
+  }
+  if (moonbit_ts_starts_with(message, "shift")) {
+    return MoonBitTSLogEventShift;
+  }
+  if (moonbit_ts_starts_with(message, "reduce sym:")) {
+    *symbol = moonbit_ts_log_symbol(context, message, "sym:", ", child_count:");
+    return MoonBitTSLogEventReduce;
+  }
+  if (moonbit_ts_starts_with(message, "accept")) {
+    return MoonBitTSLogEventAccept;
+  }
+  if (moonbit_ts_starts_with(message, "reuse_node")) {
+    *symbol = moonbit_ts_log_symbol(context, message, "symbol:", NULL);
+    return MoonBitTSLogEventReuseNode;
+  }
+  if (moonbit_ts_starts_with(message, "detect_error")) {
+    return MoonBitTSLogEventDetectError;
+  }
+  if (moonbit_ts_starts_with(message, "recover")) {
+    return MoonBitTSLogEventRecover;
+  }
+  if (moonbit_ts_starts_with(message, "skip_token")) {
+    *symbol = moonbit_ts_log_symbol(context, message, "symbol:", NULL);
+    return MoonBitTSLogEventSkipToken;
+  }
+  return MoonBitTSLogEventOther;
+}
+
+static void
+moonbit_ts_log_sink_log(
+  void *payload,
+  TSLogType log_type,
+  const char *message
+) {
+  MoonBitTSLogSink *sink = (MoonBitTSLogSink *)payload;
+  MoonBitTSLogRing *ring = sink->ring;
+  if (log_type == TSLogTypeLex && !ring->lex) {
+    return;
+  }
+  uint32_t symbol;
+  MoonBitTSLogEvent event =
+    moonbit_ts_log_classify(&sink->context, log_type, message, &symbol);
+  uint32_t state =
+    (uint32_t)moonbit_ts_log_field_or(message, "state:", UINT32_MAX);
+  uint32_t byte = sink->context.parser->lexer.current_position.bytes;
+  moonbit_ts_log_ring_lock(ring);
+  uint32_t index;
+  if (ring->length < ring->capacity) {
+    index = (ring->start + ring->length) % ring->capacity;
+    ring->length++;
+  } else {
+    index = ring->start;
+    ring->start = (ring->start + 1) % ring->capacity;
+    ring->dropped++;
+  }
+  MoonBitTSLogRecord *record = &ring->records[index];
+  record->kind = ((uint32_t)log_type << 8) | (uint32_t)event;
+  record->state = state;
+  record->symbol = symbol;
+  record->byte = byte;
+  moonbit_ts_log_ring_unlock(ring);
+}
+
+// Detach the log buffer of a parser, if it has one, dropping the parser's
+// reference to its ring.
+static inline void
+moonbit_ts_log_sink_detach(TSParser *parser) {
+  TSLogger logger = ts_parser_logger(parser);
+  if (logger.log != moonbit_ts_log_sink_log) {
+    return;
+  }
+  MoonBitTSLogSink *sink = (MoonBitTSLogSink *)logger.payload;
+  ts_parser_set_logger(parser, (TSLogger){.payload = NULL, .log = NULL});
+  moonbit_ts_log_ring_release(sink->ring);
+  free(sink->context.symbols);
+  free(sink);
+}
+
 typedef struct MoonBitTSParser {
   TSParser *parser;
 } MoonBitTSParser;
@@ -199,12 +817,15 @@ typedef struct MoonBitTSParser {
 static inline void
 moonbit_ts_parser_delete(void *object) {
   MoonBitTSParser *parser = (MoonBitTSParser *)object;
+  moonbit_ts_log_sink_detach(parser->parser);
   ts_parser_delete(parser->parser);
 }
 
 MOONBIT_FFI_EXPORT
 MoonBitTSParser *
 moonbit_ts_parser_new(void) {
+  MOONBIT_TS_STATS_CALL();
+  MOONBIT_TS_STATS_ALLOCATION();
   MoonBitTSParser *parser = (MoonBitTSParser *)moonbit_make_external_object(
     moonbit_ts_parser_delete, sizeof(TSParser *)
   );
@@ -215,12 +836,14 @@ moonbit_ts_parser_new(void) {
 MOONBIT_FFI_EXPORT
 const TSLanguage *
 moonbit_ts_parser_language(MoonBitTSParser *parser) {
+  MOONBIT_TS_STATS_CALL();
   return ts_parser_language(parser->parser);
 }
 
 MOONBIT_FFI_EXPORT
 int32_t
 moonbit_ts_parser_set_language(MoonBitTSParser *parser, TSLanguage *language) {
+  MOONBIT_TS_STATS_CALL();
   return ts_parser_set_language(parser->parser, language);
 }
 
@@ -236,6 +859,7 @@ moonbit_ts_parser_set_included_ranges(
   MoonBitTSParser *parser,
   uint32_t *ranges
 ) {
+  MOONBIT_TS_STATS_CALL();
   size_t length = Moonbit_array_length(ranges);
   uint32_t count =
     moonbit_size_to_uint(length * sizeof(uint32_t) / sizeof(TSRange));
@@ -247,8 +871,10 @@ moonbit_ts_parser_set_included_ranges(
 MOONBIT_FFI_EXPORT
 TSRange *
 moonbit_ts_parser_included_ranges(MoonBitTSParser *self) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t count = 0;
   const TSRange *ranges = ts_parser_included_ranges(self->parser, &count);
+  MOONBIT_TS_STATS_ALLOCATION();
   TSRange *copy = (TSRange *)moonbit_make_int32_array(
     count * sizeof(TSRange) / sizeof(int32_t), 0
   );
@@ -279,10 +905,12 @@ moonbit_ts_input_read(
 ) {
   struct MoonBitTSInputRead *input = (struct MoonBitTSInputRead *)payload;
   moonbit_ts_trace("input = %p\n", (void *)input);
+  MOONBIT_TS_STATS_ALLOCATION();
   TSPoint *point =
     (TSPoint *)moonbit_make_int32_array(sizeof(TSPoint) / sizeof(int32_t), 0);
   *point = position;
   moonbit_ts_trace("point = %p\n", (void *)point);
+  MOONBIT_TS_STATS_ALLOCATION();
   MoonBitTSInputReadRange *range =
     (MoonBitTSInputReadRange *)moonbit_make_int32_array(
       sizeof(MoonBitTSInputReadRange) / sizeof(int32_t), 0
@@ -308,8 +936,56 @@ moonbit_ts_input_read(
   return bytes;
 }
 
+// Tables over the nodes of a tree, built on demand by the native indexes and
+// dropped whenever the tree is edited. `nodes` lists every node in pre-order,
+// so a node's position in it is its descendant index from the root.
+typedef struct MoonBitTSTreeIndex {
+  TSNode *nodes;
+  uint32_t node_count;
+  // The position of each node's parent, `UINT32_MAX` for the root, and the
+  // position just past each node's subtree.
+  uint32_t *parents;
+  uint32_t *subtree_ends;
+  // The end of each node, and the positions of each node's children:
+  // `children[child_offsets[i]..child_offsets[i + 1]]` for node `i`.
+  uint32_t *end_bytes;
+  TSPoint *end_points;
+  uint32_t *child_offsets;
+  uint32_t *children;
+  // The depth of each node, and an open-addressing hash table from node ids
+  // to positions plus one, with `id_mask + 1` slots.
+  uint32_t *depths;
+  uint32_t *id_slots;
+  uint32_t id_mask;
+  // Positions in `nodes`, grouped by symbol: those of symbol `s` are
+  // `symbol_nodes[symbol_offsets[s]..symbol_offsets[s + 1]]`.
+  uint32_t *symbol_offsets;
+  uint32_t *symbol_nodes;
+  uint32_t symbol_count;
+} MoonBitTSTreeIndex;
+
+static inline void
+moonbit_ts_tree_index_delete(MoonBitTSTreeIndex *index) {
+  if (!index) {
+    return;
+  }
+  free(index->nodes);
+  free(index->parents);
+  free(index->subtree_ends);
+  free(index->end_bytes);
+  free(index->end_points);
+  free(index->child_offsets);
+  free(index->children);
+  free(index->depths);
+  free(index->id_slots);
+  free(index->symbol_offsets);
+  free(index->symbol_nodes);
+  free(index);
+}
+
 typedef struct MoonBitTSTree {
   TSTree *tree;
+  MoonBitTSTreeIndex *index;
 } MoonBitTSTree;
 
 static inline void
@@ -318,6 +994,18 @@ moonbit_ts_tree_delete(void *object) {
   moonbit_ts_trace("tree = %p\n", (void *)tree);
   moonbit_ts_trace("tree->tree = %p\n", (void *)tree->tree);
   ts_tree_delete(tree->tree);
+  moonbit_ts_tree_index_delete(tree->index);
+}
+
+static inline MoonBitTSTree *
+moonbit_ts_tree_new(TSTree *ts_tree) {
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSTree *tree = (MoonBitTSTree *)moonbit_make_external_object(
+    moonbit_ts_tree_delete, sizeof(MoonBitTSTree)
+  );
+  tree->tree = ts_tree;
+  tree->index = NULL;
+  return tree;
 }
 
 MOONBIT_FFI_EXPORT
@@ -329,6 +1017,7 @@ moonbit_ts_parser_parse(
   TSInputEncoding encoding,
   DecodeFunction decode
 ) {
+  MOONBIT_TS_STATS_CALL();
   TSInput ts_input = {
     .payload = input,
     .read = moonbit_ts_input_read,
@@ -336,11 +1025,9 @@ moonbit_ts_parser_parse(
     .decode = decode
   };
   TSTree *ts_old_tree = old_tree ? old_tree->tree : NULL;
-  MoonBitTSTree *tree = (MoonBitTSTree *)moonbit_make_external_object(
-    moonbit_ts_tree_delete, sizeof(TSTree *)
+  return moonbit_ts_tree_new(
+    ts_parser_parse(self->parser, ts_old_tree, ts_input)
   );
-  tree->tree = ts_parser_parse(self->parser, ts_old_tree, ts_input);
-  return tree;
 }
 
 struct MoonBitTSParseOptionsProgressCallback {
@@ -370,6 +1057,7 @@ moonbit_ts_parser_parse_with_options(
   DecodeFunction decode,
   struct MoonBitTSParseOptionsProgressCallback *progress_callback
 ) {
+  MOONBIT_TS_STATS_CALL();
   TSInput ts_input = {
     .payload = input,
     .read = moonbit_ts_input_read,
@@ -381,12 +1069,9 @@ moonbit_ts_parser_parse_with_options(
     .progress_callback = moonbit_ts_parse_options_progress_callback
   };
   TSTree *ts_old_tree = old_tree ? old_tree->tree : NULL;
-  MoonBitTSTree *tree = (MoonBitTSTree *)moonbit_make_external_object(
-    moonbit_ts_tree_delete, sizeof(MoonBitTSTree *)
+  return moonbit_ts_tree_new(
+    ts_parser_parse_with_options(self->parser, ts_old_tree, ts_input, options)
   );
-  tree->tree =
-    ts_parser_parse_with_options(self->parser, ts_old_tree, ts_input, options);
-  return tree;
 }
 
 MOONBIT_FFI_EXPORT
@@ -396,17 +1081,15 @@ moonbit_ts_parser_parse_string(
   MoonBitTSTree *old_tree,
   moonbit_bytes_t bytes
 ) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t length = Moonbit_array_length(bytes);
   TSTree *ts_old_tree = old_tree ? old_tree->tree : NULL;
-  MoonBitTSTree *tree = (MoonBitTSTree *)moonbit_make_external_object(
-    moonbit_ts_tree_delete, sizeof(MoonBitTSTree *)
-  );
   moonbit_ts_trace("ts_old_tree = %p\n", (void *)ts_old_tree);
-  tree->tree = ts_parser_parse_string(
+  TSTree *ts_tree = ts_parser_parse_string(
     self->parser, ts_old_tree, (const char *)bytes, length
   );
-  moonbit_ts_trace("tree->tree = %p\n", (void *)tree->tree);
-  return tree;
+  moonbit_ts_trace("ts_tree = %p\n", (void *)ts_tree);
+  return moonbit_ts_tree_new(ts_tree);
 }
 
 MOONBIT_FFI_EXPORT
@@ -417,22 +1100,20 @@ moonbit_ts_parser_parse_string_encoding(
   moonbit_bytes_t bytes,
   TSInputEncoding encoding
 ) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t length = Moonbit_array_length(bytes);
   TSTree *ts_old_tree = old_tree ? old_tree->tree : NULL;
-  MoonBitTSTree *tree = (MoonBitTSTree *)moonbit_make_external_object(
-    moonbit_ts_tree_delete, sizeof(MoonBitTSTree *)
-  );
-  moonbit_ts_trace("tree = %p\n", (void *)tree);
-  tree->tree = ts_parser_parse_string_encoding(
+  TSTree *ts_tree = ts_parser_parse_string_encoding(
     self->parser, ts_old_tree, (const char *)bytes, length, encoding
   );
-  moonbit_ts_trace("tree->tree = %p\n", (void *)tree->tree);
-  return tree;
+  moonbit_ts_trace("ts_tree = %p\n", (void *)ts_tree);
+  return moonbit_ts_tree_new(ts_tree);
 }
 
 MOONBIT_FFI_EXPORT
 void
 moonbit_ts_parser_reset(MoonBitTSParser *self) {
+  MOONBIT_TS_STATS_CALL();
   ts_parser_reset(self->parser);
 }
 
@@ -447,8 +1128,10 @@ struct MoonBitTSLogger {
 MOONBIT_FFI_EXPORT
 void
 moonbit_ts_logger_log(void *payload, TSLogType log_type, const char *buffer) {
+  MOONBIT_TS_STATS_CALL();
   struct MoonBitTSLogger *logger = (struct MoonBitTSLogger *)payload;
   size_t length = strlen(buffer);
+  MOONBIT_TS_STATS_ALLOCATION();
   moonbit_bytes_t bytes = moonbit_make_bytes_sz(length, 0);
   memcpy(bytes, buffer, length);
   logger->log(logger, log_type, bytes);
@@ -460,6 +1143,8 @@ moonbit_ts_parser_set_logger(
   MoonBitTSParser *self,
   struct MoonBitTSLogger *logger
 ) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_log_sink_detach(self->parser);
   TSLogger ts_logger = {.payload = logger, .log = moonbit_ts_logger_log};
   ts_parser_set_logger(self->parser, ts_logger);
 }
@@ -467,106 +1152,608 @@ moonbit_ts_parser_set_logger(
 MOONBIT_FFI_EXPORT
 struct MoonBitTSLogger *
 moonbit_ts_parser_logger(MoonBitTSParser *self) {
+  MOONBIT_TS_STATS_CALL();
   TSLogger logger = ts_parser_logger(self->parser);
+  if (logger.log != moonbit_ts_logger_log) {
+    return NULL;
+  }
   return logger.payload;
 }
 
 MOONBIT_FFI_EXPORT
-MoonBitTSTree *
-moonbit_ts_tree_copy(MoonBitTSTree *self) {
-  MoonBitTSTree *tree = (MoonBitTSTree *)moonbit_make_external_object(
-    moonbit_ts_tree_delete, sizeof(MoonBitTSTree *)
+MoonBitTSLogBuffer *
+moonbit_ts_log_buffer_new(uint32_t capacity, int32_t lex) {
+  MOONBIT_TS_STATS_CALL();
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSLogRing *ring = (MoonBitTSLogRing *)calloc(1, sizeof(*ring));
+  ring->capacity = capacity > 0 ? capacity : 1;
+  MOONBIT_TS_STATS_ALLOCATION();
+  ring->records = (MoonBitTSLogRecord *)malloc(
+    ring->capacity * sizeof(MoonBitTSLogRecord)
   );
-  tree->tree = ts_tree_copy(self->tree);
-  return tree;
+  ring->lex = lex != 0;
+  ring->references = 1;
+#ifdef _WIN32
+  InitializeSRWLock(&ring->lock);
+#else
+  pthread_mutex_init(&ring->lock, NULL);
+#endif
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSLogBuffer *buffer = moonbit_make_external_object(
+    moonbit_ts_log_buffer_delete, sizeof(MoonBitTSLogBuffer)
+  );
+  buffer->ring = ring;
+  return buffer;
 }
 
-typedef struct MoonBitTSNode {
-  TSNode node;
-} MoonBitTSNode;
-
-static inline MoonBitTSNode *
-moonbit_ts_node_new(TSNode node) {
-  MoonBitTSNode *self =
-    (MoonBitTSNode *)moonbit_make_bytes_sz(sizeof(MoonBitTSNode), 0);
-  self->node = node;
-  moonbit_ts_trace("self = %p\n", (void *)self);
-  moonbit_ts_trace("self->node.id = %p\n", self->node.id);
-  return self;
+MOONBIT_FFI_EXPORT
+void
+moonbit_ts_parser_set_log_buffer(
+  MoonBitTSParser *self,
+  MoonBitTSLogBuffer *buffer
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_log_sink_detach(self->parser);
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSLogSink *sink = (MoonBitTSLogSink *)calloc(1, sizeof(*sink));
+  sink->ring = buffer->ring;
+  sink->context.parser = self->parser;
+  moonbit_ts_log_ring_retain(buffer->ring);
+  TSLogger logger = {.payload = sink, .log = moonbit_ts_log_sink_log};
+  ts_parser_set_logger(self->parser, logger);
 }
 
 MOONBIT_FFI_EXPORT
-MoonBitTSNode *
-moonbit_ts_tree_root_node(MoonBitTSTree *tree) {
-  TSNode node = ts_tree_root_node(tree->tree);
-  return moonbit_ts_node_new(node);
+void
+moonbit_ts_parser_remove_log_buffer(MoonBitTSParser *self) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_log_sink_detach(self->parser);
 }
 
 MOONBIT_FFI_EXPORT
-MoonBitTSNode *
-moonbit_ts_tree_root_node_with_offset(
-  MoonBitTSTree *tree,
-  uint32_t offset_bytes,
-  TSPoint *offset_extent
-) {
-  moonbit_ts_trace("tree = %p\n", (void *)tree);
-  TSNode node =
-    ts_tree_root_node_with_offset(tree->tree, offset_bytes, *offset_extent);
-  return moonbit_ts_node_new(node);
+uint32_t
+moonbit_ts_log_buffer_length(MoonBitTSLogBuffer *self) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_log_ring_lock(self->ring);
+  uint32_t length = self->ring->length;
+  moonbit_ts_log_ring_unlock(self->ring);
+  return length;
 }
 
 MOONBIT_FFI_EXPORT
-const TSLanguage *
-moonbit_ts_tree_language(MoonBitTSTree *tree) {
-  return ts_tree_language(tree->tree);
+uint64_t
+moonbit_ts_log_buffer_dropped(MoonBitTSLogBuffer *self) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_log_ring_lock(self->ring);
+  uint64_t dropped = self->ring->dropped;
+  moonbit_ts_log_ring_unlock(self->ring);
+  return dropped;
 }
 
+// Remove up to `max` of the oldest records, returned flattened as four words
+// per record.
 MOONBIT_FFI_EXPORT
-TSRange *
-moonbit_ts_tree_included_ranges(MoonBitTSTree *tree) {
-  uint32_t count = 0;
-  TSRange *ranges = ts_tree_included_ranges(tree->tree, &count);
-  TSRange *copy = (TSRange *)moonbit_make_int32_array(
-    count * sizeof(TSRange) / sizeof(int32_t), 0
-  );
-  memcpy(copy, ranges, count * sizeof(TSRange));
-  free(ranges);
-  return copy;
+uint32_t *
+moonbit_ts_log_buffer_drain(MoonBitTSLogBuffer *self, uint32_t max) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSLogRing *ring = self->ring;
+  moonbit_ts_log_ring_lock(ring);
+  uint32_t count = ring->length < max ? ring->length : max;
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *words = (uint32_t *)moonbit_make_int32_array(count * 4, 0);
+  for (uint32_t i = 0; i < count; i++) {
+    MoonBitTSLogRecord *record =
+      &ring->records[(ring->start + i) % ring->capacity];
+    words[i * 4] = record->kind;
+    words[i * 4 + 1] = record->state;
+    words[i * 4 + 2] = record->symbol;
+    words[i * 4 + 3] = record->byte;
+  }
+  ring->start = (ring->start + count) % ring->capacity;
+  ring->length -= count;
+  moonbit_ts_log_ring_unlock(ring);
+  return words;
 }
 
 MOONBIT_FFI_EXPORT
 void
-moonbit_ts_tree_edit(MoonBitTSTree *tree, TSInputEdit *edit) {
-  ts_tree_edit(tree->tree, edit);
+moonbit_ts_log_buffer_clear(MoonBitTSLogBuffer *self) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_log_ring_lock(self->ring);
+  self->ring->start = 0;
+  self->ring->length = 0;
+  self->ring->dropped = 0;
+  moonbit_ts_log_ring_unlock(self->ring);
+}
+
+static inline uint64_t
+moonbit_ts_clock_nanos(void) {
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000u +
+         (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000u /
+           frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
 }
 
-MOONBIT_FFI_EXPORT
-TSRange *
-moonbit_ts_tree_get_changed_ranges(
-  MoonBitTSTree *old_tree,
-  MoonBitTSTree *new_tree
+// Parse statistics are gathered from the parser's debug log: while they are
+// being collected, the parser's logger is replaced by one that classifies the
+// messages and then forwards them to the previous logger, if any.
+typedef struct MoonBitTSParseStats {
+  TSLogger previous;
+  uint64_t bytes_lexed;
+  uint64_t tokens_lexed;
+  uint64_t subtrees_reused;
+  uint64_t nodes_reduced;
+  uint64_t max_stack_versions;
+  uint64_t lex_nanos;
+  uint64_t lex_started;
+  uint64_t parse_started;
+} MoonBitTSParseStats;
+
+static void
+moonbit_ts_parse_stats_log(
+  void *payload,
+  TSLogType log_type,
+  const char *buffer
 ) {
-  uint32_t count = 0;
-  TSRange *ranges =
-    ts_tree_get_changed_ranges(old_tree->tree, new_tree->tree, &count);
-  TSRange *copy = (TSRange *)moonbit_make_int32_array(
-    count * sizeof(TSRange) / sizeof(int32_t), 0
-  );
-  memcpy(copy, ranges, count * sizeof(TSRange));
-  free(ranges);
-  return copy;
+  MoonBitTSParseStats *stats = (MoonBitTSParseStats *)payload;
+  if (log_type == TSLogTypeParse) {
+    if (moonbit_ts_starts_with(buffer, "lex_internal") ||
+        moonbit_ts_starts_with(buffer, "lex_external")) {
+      if (stats->lex_started == 0) {
+        stats->lex_started = moonbit_ts_clock_nanos();
+      }
+    } else if (moonbit_ts_starts_with(buffer, "lexed_lookahead")) {
+      stats->tokens_lexed++;
+      stats->bytes_lexed += moonbit_ts_log_field(buffer, "size:");
+      if (stats->lex_started != 0) {
+        stats->lex_nanos += moonbit_ts_clock_nanos() - stats->lex_started;
+        stats->lex_started = 0;
+      }
+    } else if (moonbit_ts_starts_with(buffer, "reuse_node")) {
+      stats->subtrees_reused++;
+    } else if (moonbit_ts_starts_with(buffer, "reduce sym:")) {
+      stats->nodes_reduced++;
+    } else if (moonbit_ts_starts_with(buffer, "process version:")) {
+      uint64_t versions = moonbit_ts_log_field(buffer, "version_count:");
+      if (versions > stats->max_stack_versions) {
+        stats->max_stack_versions = versions;
+      }
+    }
+  }
+  if (stats->previous.log) {
+    stats->previous.log(stats->previous.payload, log_type, buffer);
+  }
 }
 
 MOONBIT_FFI_EXPORT
-const char *
-moonbit_ts_node_type(MoonBitTSNode *self, MoonBitTSTree *tree) {
-  moonbit_ts_ignore(tree);
-  return ts_node_type(self->node);
+MoonBitTSParseStats *
+moonbit_ts_parser_parse_stats_begin(MoonBitTSParser *self) {
+  MOONBIT_TS_STATS_CALL();
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSParseStats *stats = (MoonBitTSParseStats *)moonbit_make_bytes_sz(
+    sizeof(MoonBitTSParseStats), 0
+  );
+  stats->previous = ts_parser_logger(self->parser);
+  TSLogger logger = {.payload = stats, .log = moonbit_ts_parse_stats_log};
+  ts_parser_set_logger(self->parser, logger);
+  stats->parse_started = moonbit_ts_clock_nanos();
+  return stats;
 }
 
+// The statistics are returned flattened as `[bytes_lexed, tokens_lexed,
+// subtrees_reused, nodes_reduced, max_stack_versions, lex_nanos, parse_nanos]`,
+// where `parse_nanos` is the time spent outside of the lexer.
 MOONBIT_FFI_EXPORT
-TSSymbol
+uint64_t *
+moonbit_ts_parser_parse_stats_end(
+  MoonBitTSParser *self,
+  MoonBitTSParseStats *stats
+) {
+  MOONBIT_TS_STATS_CALL();
+  uint64_t total = moonbit_ts_clock_nanos() - stats->parse_started;
+  ts_parser_set_logger(self->parser, stats->previous);
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint64_t *result = (uint64_t *)moonbit_make_int64_array(7, 0);
+  result[0] = stats->bytes_lexed;
+  result[1] = stats->tokens_lexed;
+  result[2] = stats->subtrees_reused;
+  result[3] = stats->nodes_reduced;
+  result[4] = stats->max_stack_versions;
+  result[5] = stats->lex_nanos;
+  result[6] = total > stats->lex_nanos ? total - stats->lex_nanos : 0;
+  return result;
+}
+
+// A parse profile counts, like parse statistics, what the parser's debug log
+// reports, but per parse state and per lookahead symbol. Its counts are laid
+// out as `[states, error_states, lookaheads]`, sized for the language the
+// parser had when profiling began.
+typedef struct MoonBitTSParseProfile {
+  TSLogger previous;
+  MoonBitTSLogContext context;
+  uint32_t state_count;
+  uint32_t symbol_count;
+  uint32_t state;
+  uint32_t error_detections;
+  uint32_t recoveries;
+  uint32_t skipped_tokens;
+  uint32_t max_stack_versions;
+  uint32_t counts[];
+} MoonBitTSParseProfile;
+
+static void
+moonbit_ts_parse_profile_log(
+  void *payload,
+  TSLogType log_type,
+  const char *buffer
+) {
+  MoonBitTSParseProfile *profile = (MoonBitTSParseProfile *)payload;
+  if (log_type == TSLogTypeParse) {
+    uint32_t symbol;
+    MoonBitTSLogEvent event =
+      moonbit_ts_log_classify(&profile->context, log_type, buffer, &symbol);
+    uint32_t *states = profile->counts;
+    uint32_t *error_states = states + profile->state_count;
+    uint32_t *lookaheads = error_states + profile->state_count;
+    switch (event) {
+    case MoonBitTSLogEventProcess: {
+      uint32_t versions =
+        (uint32_t)moonbit_ts_log_field(buffer, "version_count:");
+      if (versions > profile->max_stack_versions) {
+        profile->max_stack_versions = versions;
+      }
+      profile->state =
+        (uint32_t)moonbit_ts_log_field_or(buffer, "state:", UINT32_MAX);
+      if (profile->state < profile->state_count) {
+        states[profile->state]++;
+      }
+      break;
+    }
+    case MoonBitTSLogEventLexedLookahead:
+      if (symbol < profile->symbol_count) {
+        lookaheads[symbol]++;
+      }
+      break;
+    case MoonBitTSLogEventDetectError:
+      profile->error_detections++;
+      if (profile->state < profile->state_count) {
+        error_states[profile->state]++;
+      }
+      break;
+    case MoonBitTSLogEventRecover:
+      profile->recoveries++;
+      break;
+    case MoonBitTSLogEventSkipToken:
+      profile->skipped_tokens++;
+      break;
+    default:
+      break;
+    }
+  }
+  if (profile->previous.log) {
+    profile->previous.log(profile->previous.payload, log_type, buffer);
+  }
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSParseProfile *
+moonbit_ts_parser_parse_profile_begin(MoonBitTSParser *self) {
+  MOONBIT_TS_STATS_CALL();
+  const TSLanguage *language = ts_parser_language(self->parser);
+  uint32_t state_count = language ? ts_language_state_count(language) : 0;
+  uint32_t symbol_count = language ? ts_language_symbol_count(language) : 0;
+  size_t counts = 2 * (size_t)state_count + symbol_count;
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSParseProfile *profile =
+    (MoonBitTSParseProfile *)moonbit_make_bytes_sz(
+      sizeof(MoonBitTSParseProfile) + counts * sizeof(uint32_t), 0
+    );
+  profile->context.parser = self->parser;
+  profile->state_count = state_count;
+  profile->symbol_count = symbol_count;
+  profile->state = UINT32_MAX;
+  profile->previous = ts_parser_logger(self->parser);
+  TSLogger logger = {.payload = profile, .log = moonbit_ts_parse_profile_log};
+  ts_parser_set_logger(self->parser, logger);
+  return profile;
+}
+
+// The profile is returned flattened as `[state_count, symbol_count,
+// error_detections, recoveries, skipped_tokens, max_stack_versions]` followed
+// by its counts.
+MOONBIT_FFI_EXPORT
+uint32_t *
+moonbit_ts_parser_parse_profile_end(
+  MoonBitTSParser *self,
+  MoonBitTSParseProfile *profile
+) {
+  MOONBIT_TS_STATS_CALL();
+  ts_parser_set_logger(self->parser, profile->previous);
+  free(profile->context.symbols);
+  profile->context.symbols = NULL;
+  size_t counts = 2 * (size_t)profile->state_count + profile->symbol_count;
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *result = (uint32_t *)moonbit_make_int32_array(6 + counts, 0);
+  result[0] = profile->state_count;
+  result[1] = profile->symbol_count;
+  result[2] = profile->error_detections;
+  result[3] = profile->recoveries;
+  result[4] = profile->skipped_tokens;
+  result[5] = profile->max_stack_versions;
+  memcpy(result + 6, profile->counts, counts * sizeof(uint32_t));
+  return result;
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSTree *
+moonbit_ts_tree_copy(MoonBitTSTree *self) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_tree_new(ts_tree_copy(self->tree));
+}
+
+// A parse job runs `ts_parser_parse_string_encoding` on a native thread. The
+// job owns a copy of the source and of the old tree, and holds a reference to
+// the parser until the thread has been joined, so the caller may keep using
+// its own trees (but not the parser) while the job is running.
+typedef struct MoonBitTSParseJob {
+  MoonBitTSParser *parser;
+  TSTree *old_tree;
+  char *source;
+  uint32_t length;
+  TSInputEncoding encoding;
+  TSTree *result;
+  volatile int32_t done;
+  bool joined;
+#ifdef _WIN32
+  HANDLE thread;
+#else
+  pthread_t thread;
+#endif
+} MoonBitTSParseJob;
+
+static inline void
+moonbit_ts_parse_job_set_done(MoonBitTSParseJob *job) {
+#ifdef _WIN32
+  InterlockedExchange((volatile LONG *)&job->done, 1);
+#else
+  __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+#endif
+}
+
+static inline bool
+moonbit_ts_parse_job_get_done(MoonBitTSParseJob *job) {
+#ifdef _WIN32
+  return InterlockedCompareExchange((volatile LONG *)&job->done, 0, 0) != 0;
+#else
+  return __atomic_load_n(&job->done, __ATOMIC_ACQUIRE) != 0;
+#endif
+}
+
+static inline void
+moonbit_ts_parse_job_run(MoonBitTSParseJob *job) {
+  job->result = ts_parser_parse_string_encoding(
+    job->parser->parser, job->old_tree, job->source, job->length, job->encoding
+  );
+  moonbit_ts_parse_job_set_done(job);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+moonbit_ts_parse_job_thread(LPVOID payload) {
+  moonbit_ts_parse_job_run((MoonBitTSParseJob *)payload);
+  return 0;
+}
+#else
+static void *
+moonbit_ts_parse_job_thread(void *payload) {
+  moonbit_ts_parse_job_run((MoonBitTSParseJob *)payload);
+  return NULL;
+}
+#endif
+
+static inline void
+moonbit_ts_parse_job_release(MoonBitTSParseJob *job) {
+  job->joined = true;
+  ts_tree_delete(job->old_tree);
+  job->old_tree = NULL;
+  free(job->source);
+  job->source = NULL;
+  moonbit_decref(job->parser);
+  job->parser = NULL;
+}
+
+static inline void
+moonbit_ts_parse_job_join(MoonBitTSParseJob *job) {
+  if (job->joined) {
+    return;
+  }
+#ifdef _WIN32
+  WaitForSingleObject(job->thread, INFINITE);
+  CloseHandle(job->thread);
+#else
+  pthread_join(job->thread, NULL);
+#endif
+  moonbit_ts_parse_job_release(job);
+}
+
+static inline void
+moonbit_ts_parse_job_delete(void *object) {
+  MoonBitTSParseJob *job = (MoonBitTSParseJob *)object;
+  moonbit_ts_parse_job_join(job);
+  if (job->result) {
+    ts_tree_delete(job->result);
+  }
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSParseJob *
+moonbit_ts_parse_job_start(
+  MoonBitTSParser *parser,
+  MoonBitTSTree *old_tree,
+  moonbit_bytes_t bytes,
+  TSInputEncoding encoding
+) {
+  MOONBIT_TS_STATS_CALL();
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSParseJob *job = (MoonBitTSParseJob *)moonbit_make_external_object(
+    moonbit_ts_parse_job_delete, sizeof(MoonBitTSParseJob)
+  );
+  uint32_t length = Moonbit_array_length(bytes);
+  MOONBIT_TS_STATS_ALLOCATION();
+  job->source = (char *)malloc(length > 0 ? length : 1);
+  memcpy(job->source, bytes, length);
+  job->length = length;
+  job->encoding = encoding;
+  job->old_tree = old_tree ? ts_tree_copy(old_tree->tree) : NULL;
+  moonbit_incref(parser);
+  job->parser = parser;
+  job->result = NULL;
+  job->done = 0;
+  job->joined = false;
+#ifdef _WIN32
+  job->thread =
+    CreateThread(NULL, 0, moonbit_ts_parse_job_thread, job, 0, NULL);
+  bool started = job->thread != NULL;
+#else
+  bool started =
+    pthread_create(&job->thread, NULL, moonbit_ts_parse_job_thread, job) == 0;
+#endif
+  if (!started) {
+    // Fall back to parsing on the caller's thread.
+    moonbit_ts_trace("failed to spawn parse thread\n");
+    moonbit_ts_parse_job_run(job);
+    moonbit_ts_parse_job_release(job);
+  }
+  return job;
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_parse_job_is_done(MoonBitTSParseJob *job) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_parse_job_get_done(job);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSTree *
+moonbit_ts_parse_job_wait(MoonBitTSParseJob *job) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_parse_job_join(job);
+  TSTree *result = job->result;
+  job->result = NULL;
+  if (!result) {
+    return NULL;
+  }
+  return moonbit_ts_tree_new(result);
+}
+
+typedef struct MoonBitTSNode {
+  TSNode node;
+} MoonBitTSNode;
+
+static inline MoonBitTSNode *
+moonbit_ts_node_new(TSNode node) {
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSNode *self =
+    (MoonBitTSNode *)moonbit_make_bytes_sz(sizeof(MoonBitTSNode), 0);
+  self->node = node;
+  moonbit_ts_trace("self = %p\n", (void *)self);
+  moonbit_ts_trace("self->node.id = %p\n", self->node.id);
+  return self;
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNode *
+moonbit_ts_tree_root_node(MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
+  TSNode node = ts_tree_root_node(tree->tree);
+  return moonbit_ts_node_new(node);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNode *
+moonbit_ts_tree_root_node_with_offset(
+  MoonBitTSTree *tree,
+  uint32_t offset_bytes,
+  TSPoint *offset_extent
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_trace("tree = %p\n", (void *)tree);
+  TSNode node =
+    ts_tree_root_node_with_offset(tree->tree, offset_bytes, *offset_extent);
+  return moonbit_ts_node_new(node);
+}
+
+MOONBIT_FFI_EXPORT
+const TSLanguage *
+moonbit_ts_tree_language(MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_language(tree->tree);
+}
+
+MOONBIT_FFI_EXPORT
+TSRange *
+moonbit_ts_tree_included_ranges(MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
+  uint32_t count = 0;
+  TSRange *ranges = ts_tree_included_ranges(tree->tree, &count);
+  MOONBIT_TS_STATS_ALLOCATION();
+  TSRange *copy = (TSRange *)moonbit_make_int32_array(
+    count * sizeof(TSRange) / sizeof(int32_t), 0
+  );
+  memcpy(copy, ranges, count * sizeof(TSRange));
+  free(ranges);
+  return copy;
+}
+
+MOONBIT_FFI_EXPORT
+void
+moonbit_ts_tree_edit(MoonBitTSTree *tree, TSInputEdit *edit) {
+  MOONBIT_TS_STATS_CALL();
+  ts_tree_edit(tree->tree, edit);
+  moonbit_ts_tree_index_delete(tree->index);
+  tree->index = NULL;
+}
+
+MOONBIT_FFI_EXPORT
+TSRange *
+moonbit_ts_tree_get_changed_ranges(
+  MoonBitTSTree *old_tree,
+  MoonBitTSTree *new_tree
+) {
+  MOONBIT_TS_STATS_CALL();
+  uint32_t count = 0;
+  TSRange *ranges =
+    ts_tree_get_changed_ranges(old_tree->tree, new_tree->tree, &count);
+  MOONBIT_TS_STATS_ALLOCATION();
+  TSRange *copy = (TSRange *)moonbit_make_int32_array(
+    count * sizeof(TSRange) / sizeof(int32_t), 0
+  );
+  memcpy(copy, ranges, count * sizeof(TSRange));
+  free(ranges);
+  return copy;
+}
+
+MOONBIT_FFI_EXPORT
+const char *
+moonbit_ts_node_type(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(tree);
+  return ts_node_type(self->node);
+}
+
+MOONBIT_FFI_EXPORT
+TSSymbol
 moonbit_ts_node_symbol(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_symbol(self->node);
 }
@@ -574,6 +1761,7 @@ moonbit_ts_node_symbol(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 const TSLanguage *
 moonbit_ts_node_language(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_language(self->node);
 }
@@ -581,6 +1769,7 @@ moonbit_ts_node_language(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 const char *
 moonbit_ts_node_grammar_type(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_grammar_type(self->node);
 }
@@ -588,6 +1777,7 @@ moonbit_ts_node_grammar_type(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 TSSymbol
 moonbit_ts_node_grammar_symbol(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_grammar_symbol(self->node);
 }
@@ -595,6 +1785,7 @@ moonbit_ts_node_grammar_symbol(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_node_start_byte(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_start_byte(self->node);
 }
@@ -602,7 +1793,9 @@ moonbit_ts_node_start_byte(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 TSPoint *
 moonbit_ts_node_start_point(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
+  MOONBIT_TS_STATS_ALLOCATION();
   TSPoint *point = (TSPoint *)moonbit_make_int32_array(
     sizeof(struct TSPoint) / sizeof(int32_t), 0
   );
@@ -613,6 +1806,7 @@ moonbit_ts_node_start_point(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_node_end_byte(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_end_byte(self->node);
 }
@@ -620,7 +1814,9 @@ moonbit_ts_node_end_byte(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 TSPoint *
 moonbit_ts_node_end_point(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
+  MOONBIT_TS_STATS_ALLOCATION();
   TSPoint *point = (TSPoint *)moonbit_make_int32_array(
     sizeof(struct TSPoint) / sizeof(int32_t), 0
   );
@@ -631,11 +1827,13 @@ moonbit_ts_node_end_point(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 moonbit_bytes_t
 moonbit_ts_node_string(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   moonbit_ts_trace("self = %p\n", (void *)self);
   moonbit_ts_trace("self->node.id = %p\n", self->node.id);
   char *string = ts_node_string(self->node);
   size_t length = strlen(string);
+  MOONBIT_TS_STATS_ALLOCATION();
   moonbit_bytes_t bytes = moonbit_make_bytes_sz(length, 0);
   memcpy(bytes, string, length);
   free(string);
@@ -645,6 +1843,7 @@ moonbit_ts_node_string(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 int32_t
 moonbit_ts_node_is_null(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   bool result = ts_node_is_null(self->node);
   moonbit_ts_trace("result = %d\n", result);
@@ -654,6 +1853,7 @@ moonbit_ts_node_is_null(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 int32_t
 moonbit_ts_node_is_named(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_is_named(self->node);
 }
@@ -661,6 +1861,7 @@ moonbit_ts_node_is_named(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 int32_t
 moonbit_ts_node_is_missing(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_is_missing(self->node);
 }
@@ -668,6 +1869,7 @@ moonbit_ts_node_is_missing(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 int32_t
 moonbit_ts_node_is_extra(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_is_extra(self->node);
 }
@@ -675,6 +1877,7 @@ moonbit_ts_node_is_extra(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 int32_t
 moonbit_ts_node_has_changes(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_has_changes(self->node);
 }
@@ -682,6 +1885,7 @@ moonbit_ts_node_has_changes(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 int32_t
 moonbit_ts_node_has_error(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_has_error(self->node);
 }
@@ -689,6 +1893,7 @@ moonbit_ts_node_has_error(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 int32_t
 moonbit_ts_node_is_error(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_is_error(self->node);
 }
@@ -696,6 +1901,7 @@ moonbit_ts_node_is_error(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 TSStateId
 moonbit_ts_node_parse_state(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_parse_state(self->node);
 }
@@ -703,6 +1909,7 @@ moonbit_ts_node_parse_state(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 TSStateId
 moonbit_ts_node_next_parse_state(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_next_parse_state(self->node);
 }
@@ -710,6 +1917,7 @@ moonbit_ts_node_next_parse_state(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 MoonBitTSNode *
 moonbit_ts_node_parent(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSNode node = ts_node_parent(self->node);
   return moonbit_ts_node_new(node);
@@ -723,6 +1931,7 @@ moonbit_ts_node_child_with_descendant(
   MoonBitTSNode *descendant,
   MoonBitTSTree *descendant_tree
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(self_tree);
   moonbit_ts_ignore(descendant_tree);
   TSNode node = ts_node_child_with_descendant(self->node, descendant->node);
@@ -736,6 +1945,7 @@ moonbit_ts_node_child(
   MoonBitTSTree *tree,
   uint32_t child_index
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSNode node = ts_node_child(self->node, child_index);
   return moonbit_ts_node_new(node);
@@ -748,6 +1958,7 @@ moonbit_ts_node_field_name_for_child(
   MoonBitTSTree *tree,
   uint32_t child_index
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_field_name_for_child(self->node, child_index);
 }
@@ -759,6 +1970,7 @@ moonbit_ts_node_field_name_for_named_child(
   MoonBitTSTree *tree,
   uint32_t named_child_index
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_field_name_for_named_child(self->node, named_child_index);
 }
@@ -766,6 +1978,7 @@ moonbit_ts_node_field_name_for_named_child(
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_node_child_count(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_child_count(self->node);
 }
@@ -777,6 +1990,7 @@ moonbit_ts_node_named_child(
   MoonBitTSTree *tree,
   uint32_t child_index
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSNode node = ts_node_named_child(self->node, child_index);
   return moonbit_ts_node_new(node);
@@ -785,6 +1999,7 @@ moonbit_ts_node_named_child(
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_node_named_child_count(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   return ts_node_named_child_count(self->node);
 }
@@ -796,6 +2011,7 @@ moonbit_ts_node_child_by_field_name(
   MoonBitTSTree *tree,
   moonbit_bytes_t name
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   uint32_t length = Moonbit_array_length(name);
   TSNode node =
@@ -810,6 +2026,7 @@ moonbit_ts_node_child_by_field_id(
   MoonBitTSTree *tree,
   TSFieldId field_id
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSNode node = ts_node_child_by_field_id(self->node, field_id);
   return moonbit_ts_node_new(node);
@@ -818,6 +2035,7 @@ moonbit_ts_node_child_by_field_id(
 MOONBIT_FFI_EXPORT
 MoonBitTSNode *
 moonbit_ts_node_next_sibling(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSNode node = ts_node_next_sibling(self->node);
   return moonbit_ts_node_new(node);
@@ -826,6 +2044,7 @@ moonbit_ts_node_next_sibling(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 MoonBitTSNode *
 moonbit_ts_node_prev_sibling(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSNode node = ts_node_prev_sibling(self->node);
   return moonbit_ts_node_new(node);
@@ -834,6 +2053,7 @@ moonbit_ts_node_prev_sibling(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 MoonBitTSNode *
 moonbit_ts_node_next_named_sibling(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSNode node = ts_node_next_named_sibling(self->node);
   return moonbit_ts_node_new(node);
@@ -842,6 +2062,7 @@ moonbit_ts_node_next_named_sibling(MoonBitTSNode *self, MoonBitTSTree *tree) {
 MOONBIT_FFI_EXPORT
 MoonBitTSNode *
 moonbit_ts_node_prev_named_sibling(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSNode node = ts_node_prev_named_sibling(self->node);
   return moonbit_ts_node_new(node);
@@ -854,6 +2075,7 @@ moonbit_ts_node_first_child_for_byte(
   MoonBitTSTree *tree,
   uint32_t byte
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSNode node = ts_node_first_child_for_byte(self->node, byte);
   return moonbit_ts_node_new(node);
@@ -866,236 +2088,2638 @@ moonbit_ts_node_first_named_child_for_byte(
   MoonBitTSTree *tree,
   uint32_t byte
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSNode node = ts_node_first_named_child_for_byte(self->node, byte);
   return moonbit_ts_node_new(node);
 }
 
-MOONBIT_FFI_EXPORT
-uint32_t
-moonbit_ts_node_descendant_count(MoonBitTSNode *self, MoonBitTSTree *tree) {
-  moonbit_ts_ignore(tree);
-  uint32_t count = ts_node_descendant_count(self->node);
-  return count;
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_node_descendant_count(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(tree);
+  uint32_t count = ts_node_descendant_count(self->node);
+  return count;
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNode *
+moonbit_ts_node_descendant_for_byte_range(
+  MoonBitTSNode *self,
+  MoonBitTSTree *tree,
+  uint32_t start,
+  uint32_t end
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(tree);
+  TSNode node = ts_node_descendant_for_byte_range(self->node, start, end);
+  return moonbit_ts_node_new(node);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNode *
+moonbit_ts_node_descendant_for_point_range(
+  MoonBitTSNode *self,
+  MoonBitTSTree *tree,
+  TSPoint *start,
+  TSPoint *end
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(tree);
+  TSNode node = ts_node_descendant_for_point_range(self->node, *start, *end);
+  return moonbit_ts_node_new(node);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNode *
+moonbit_ts_node_named_descendant_for_byte_range(
+  MoonBitTSNode *self,
+  MoonBitTSTree *tree,
+  uint32_t start,
+  uint32_t end
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(tree);
+  TSNode node = ts_node_named_descendant_for_byte_range(self->node, start, end);
+  return moonbit_ts_node_new(node);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNode *
+moonbit_ts_node_named_descendant_for_point_range(
+  MoonBitTSNode *self,
+  MoonBitTSTree *tree,
+  TSPoint *start,
+  TSPoint *end
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(tree);
+  TSNode node =
+    ts_node_named_descendant_for_point_range(self->node, *start, *end);
+  return moonbit_ts_node_new(node);
+}
+
+MOONBIT_FFI_EXPORT
+void
+moonbit_ts_node_edit(
+  MoonBitTSNode *self,
+  MoonBitTSTree *tree,
+  TSInputEdit *edit
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(tree);
+  ts_node_edit(&self->node, edit);
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_node_eq(
+  MoonBitTSNode *self,
+  MoonBitTSTree *self_tree,
+  MoonBitTSNode *other,
+  MoonBitTSTree *other_tree
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(self_tree);
+  moonbit_ts_ignore(other_tree);
+  return ts_node_eq(self->node, other->node);
+}
+
+MOONBIT_FFI_EXPORT
+uint64_t
+moonbit_ts_node_id_as_uint64(MoonBitTSNode *self, MoonBitTSTree *self_tree) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(self_tree);
+  return (uintptr_t)self->node.id;
+}
+
+typedef struct MoonBitTSTreeCursor {
+  TSTreeCursor cursor;
+} MoonBitTSTreeCursor;
+
+static inline void
+moonbit_ts_tree_cursor_delete(void *object) {
+  MoonBitTSTreeCursor *cursor = (MoonBitTSTreeCursor *)object;
+  ts_tree_cursor_delete(&cursor->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSTreeCursor *
+moonbit_ts_tree_cursor_new(MoonBitTSNode *node) {
+  MOONBIT_TS_STATS_CALL();
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSTreeCursor *cursor =
+    (MoonBitTSTreeCursor *)moonbit_make_external_object(
+      moonbit_ts_tree_cursor_delete, sizeof(MoonBitTSTreeCursor)
+    );
+  cursor->cursor = ts_tree_cursor_new(node->node);
+  return cursor;
+}
+
+MOONBIT_FFI_EXPORT
+void
+moonbit_ts_tree_cursor_reset(MoonBitTSTreeCursor *self, MoonBitTSNode *node) {
+  MOONBIT_TS_STATS_CALL();
+  ts_tree_cursor_reset(&self->cursor, node->node);
+}
+
+MOONBIT_FFI_EXPORT
+void
+moonbit_ts_tree_cursor_reset_to(
+  MoonBitTSTreeCursor *dst,
+  MoonBitTSTreeCursor *src
+) {
+  MOONBIT_TS_STATS_CALL();
+  ts_tree_cursor_reset_to(&dst->cursor, &src->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNode *
+moonbit_ts_tree_cursor_current_node(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  TSNode node = ts_tree_cursor_current_node(&self->cursor);
+  return moonbit_ts_node_new(node);
+}
+
+MOONBIT_FFI_EXPORT
+const char *
+moonbit_ts_tree_cursor_current_field_name(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_current_field_name(&self->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+TSFieldId
+moonbit_ts_tree_cursor_current_field_id(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_current_field_id(&self->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_tree_cursor_goto_parent(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_goto_parent(&self->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_tree_cursor_goto_next_sibling(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_goto_next_sibling(&self->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_tree_cursor_goto_previous_sibling(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_goto_previous_sibling(&self->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_tree_cursor_goto_first_child(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_goto_first_child(&self->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_tree_cursor_goto_last_child(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_goto_last_child(&self->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+void
+moonbit_ts_tree_cursor_goto_descendant(
+  MoonBitTSTreeCursor *self,
+  uint32_t goal_descendant_index
+) {
+  MOONBIT_TS_STATS_CALL();
+  ts_tree_cursor_goto_descendant(&self->cursor, goal_descendant_index);
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_tree_cursor_current_descendant_index(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_current_descendant_index(&self->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_tree_cursor_current_depth(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_current_depth(&self->cursor);
+}
+
+MOONBIT_FFI_EXPORT
+int64_t
+moonbit_ts_tree_cursor_goto_first_child_for_byte(
+  MoonBitTSTreeCursor *self,
+  uint32_t goal_byte
+) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_goto_first_child_for_byte(&self->cursor, goal_byte);
+}
+
+MOONBIT_FFI_EXPORT
+int64_t
+moonbit_ts_tree_cursor_goto_first_child_for_point(
+  MoonBitTSTreeCursor *self,
+  TSPoint *goal_point
+) {
+  MOONBIT_TS_STATS_CALL();
+  return ts_tree_cursor_goto_first_child_for_point(&self->cursor, *goal_point);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSTreeCursor *
+moonbit_ts_tree_cursor_copy(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSTreeCursor *copy =
+    (MoonBitTSTreeCursor *)moonbit_make_external_object(
+      moonbit_ts_tree_cursor_delete, sizeof(MoonBitTSTreeCursor)
+    );
+  copy->cursor = ts_tree_cursor_copy(&self->cursor);
+  return copy;
+}
+
+// A list of nodes collected natively and handed over in one call.
+typedef struct MoonBitTSNodeList {
+  TSNode *nodes;
+  uint32_t count;
+  uint32_t capacity;
+} MoonBitTSNodeList;
+
+static inline void
+moonbit_ts_node_list_delete(void *object) {
+  MoonBitTSNodeList *self = (MoonBitTSNodeList *)object;
+  free(self->nodes);
+}
+
+static inline MoonBitTSNodeList *
+moonbit_ts_node_list_new(void) {
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSNodeList *self = (MoonBitTSNodeList *)moonbit_make_external_object(
+    moonbit_ts_node_list_delete, sizeof(MoonBitTSNodeList)
+  );
+  self->nodes = NULL;
+  self->count = 0;
+  self->capacity = 0;
+  return self;
+}
+
+static inline void
+moonbit_ts_node_list_push(MoonBitTSNodeList *self, TSNode node) {
+  if (self->count == self->capacity) {
+    self->capacity = self->capacity ? self->capacity * 2 : 16;
+    MOONBIT_TS_STATS_ALLOCATION();
+    self->nodes =
+      (TSNode *)realloc(self->nodes, self->capacity * sizeof(TSNode));
+  }
+  self->nodes[self->count++] = node;
+}
+
+static inline void
+moonbit_ts_node_list_reverse(MoonBitTSNodeList *self) {
+  for (uint32_t i = 0, j = self->count; i + 1 < j; i++, j--) {
+    TSNode node = self->nodes[i];
+    self->nodes[i] = self->nodes[j - 1];
+    self->nodes[j - 1] = node;
+  }
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_node_list_count(MoonBitTSNodeList *self) {
+  MOONBIT_TS_STATS_CALL();
+  return self->count;
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNode *
+moonbit_ts_node_list_get(MoonBitTSNodeList *self, uint32_t index) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_node_new(self->nodes[index]);
+}
+
+// Collect the visible nodes on the stack of a cursor from its root down, and
+// including the current node if asked to. The nodes are built the same way as
+// `ts_tree_cursor_current_node` builds the current one: extra nodes are never
+// aliased, since they are not part of their parent's production.
+static inline MoonBitTSNodeList *
+moonbit_ts_tree_cursor_stack(const TSTreeCursor *cursor, bool include_current) {
+  const TreeCursor *self = (const TreeCursor *)cursor;
+  MoonBitTSNodeList *list = moonbit_ts_node_list_new();
+  uint32_t size = self->stack.size;
+  if (!include_current && size > 0) {
+    size--;
+  }
+  const TSLanguage *language = ts_tree_language(self->tree);
+  for (uint32_t i = 0; i < size; i++) {
+    TreeCursorEntry *entry = &self->stack.contents[i];
+    bool is_extra = ts_subtree_extra(*entry->subtree);
+    TSSymbol alias_symbol = is_extra ? 0 : self->root_alias_symbol;
+    bool is_visible = true;
+    if (i > 0) {
+      if (!is_extra) {
+        TreeCursorEntry *parent_entry = &self->stack.contents[i - 1];
+        alias_symbol = ts_language_alias_at(
+          language, ts_subtree_production_id(*parent_entry->subtree),
+          entry->structural_child_index
+        );
+      }
+      is_visible = alias_symbol != 0 || ts_subtree_visible(*entry->subtree);
+    }
+    if (is_visible) {
+      moonbit_ts_node_list_push(
+        list,
+        ts_node_new(self->tree, entry->subtree, entry->position, alias_symbol)
+      );
+    }
+  }
+  return list;
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNodeList *
+moonbit_ts_tree_cursor_path(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_tree_cursor_stack(&self->cursor, true);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNodeList *
+moonbit_ts_tree_cursor_ancestors(MoonBitTSTreeCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSNodeList *list = moonbit_ts_tree_cursor_stack(&self->cursor, false);
+  moonbit_ts_node_list_reverse(list);
+  return list;
+}
+
+// Collect the ancestors of a node, nearest first, in a single descent from the
+// root instead of one descent per `ts_node_parent` call.
+MOONBIT_FFI_EXPORT
+MoonBitTSNodeList *
+moonbit_ts_node_ancestors(MoonBitTSNode *self, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSNodeList *list = moonbit_ts_node_list_new();
+  TSNode node = ts_tree_root_node(tree->tree);
+  while (!ts_node_is_null(node) && node.id != self->node.id) {
+    moonbit_ts_node_list_push(list, node);
+    node = ts_node_child_with_descendant(node, self->node);
+  }
+  if (ts_node_is_null(node)) {
+    list->count = 0;
+  }
+  moonbit_ts_node_list_reverse(list);
+  return list;
+}
+
+typedef enum MoonBitTSNodeDiffKind {
+  MoonBitTSNodeDiffInserted,
+  MoonBitTSNodeDiffRemoved,
+  MoonBitTSNodeDiffUpdated,
+} MoonBitTSNodeDiffKind;
+
+typedef struct MoonBitTSNodeDiff {
+  MoonBitTSNodeDiffKind kind;
+  TSNode old_node;
+  TSNode new_node;
+} MoonBitTSNodeDiff;
+
+typedef struct MoonBitTSTreeDiff {
+  MoonBitTSNodeDiff *records;
+  uint32_t count;
+  uint32_t capacity;
+} MoonBitTSTreeDiff;
+
+static inline void
+moonbit_ts_tree_diff_delete(void *object) {
+  MoonBitTSTreeDiff *diff = (MoonBitTSTreeDiff *)object;
+  free(diff->records);
+}
+
+static inline void
+moonbit_ts_tree_diff_push(
+  MoonBitTSTreeDiff *diff,
+  MoonBitTSNodeDiffKind kind,
+  TSNode old_node,
+  TSNode new_node
+) {
+  if (diff->count == diff->capacity) {
+    diff->capacity = diff->capacity ? diff->capacity * 2 : 16;
+    MOONBIT_TS_STATS_ALLOCATION();
+    diff->records = (MoonBitTSNodeDiff *)realloc(
+      diff->records, diff->capacity * sizeof(MoonBitTSNodeDiff)
+    );
+  }
+  diff->records[diff->count++] = (MoonBitTSNodeDiff){
+    .kind = kind, .old_node = old_node, .new_node = new_node
+  };
+}
+
+// A node is reused if the new tree holds the same subtree at the same position
+// as the edited old tree. A node id is the address of its `Subtree` inside
+// the parent's children array, so ids only coincide when the parents are
+// shared. Otherwise, heap subtrees are compared by address. Inline subtrees
+// are only identified by their value, which equal leaves elsewhere in the
+// tree share, so they are never reused under a new parent.
+static inline bool
+moonbit_ts_node_is_reused(TSNode old_node, TSNode new_node) {
+  if (ts_node_has_changes(old_node)) {
+    return false;
+  }
+  if (ts_node_start_byte(old_node) != ts_node_start_byte(new_node)) {
+    return false;
+  }
+  if (old_node.id == new_node.id) {
+    return true;
+  }
+  const Subtree *old_subtree = (const Subtree *)old_node.id;
+  const Subtree *new_subtree = (const Subtree *)new_node.id;
+  if (old_subtree->data.is_inline || new_subtree->data.is_inline) {
+    return false;
+  }
+  return old_subtree->ptr == new_subtree->ptr;
+}
+
+// One level of the lockstep walk: whether each cursor descended into the
+// level, and whether it still points at an unvisited child.
+typedef struct MoonBitTSTreeDiffFrame {
+  bool old_entered;
+  bool new_entered;
+  bool old_live;
+  bool new_live;
+} MoonBitTSTreeDiffFrame;
+
+static void
+moonbit_ts_tree_diff_walk(
+  MoonBitTSTreeDiff *diff,
+  TSTreeCursor *old_cursor,
+  TSTreeCursor *new_cursor
+) {
+  uint32_t depth = 0;
+  uint32_t capacity = 16;
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSTreeDiffFrame *stack =
+    (MoonBitTSTreeDiffFrame *)malloc(capacity * sizeof(MoonBitTSTreeDiffFrame));
+  bool old_entered = ts_tree_cursor_goto_first_child(old_cursor);
+  bool new_entered = ts_tree_cursor_goto_first_child(new_cursor);
+  stack[depth++] = (MoonBitTSTreeDiffFrame){
+    old_entered, new_entered, old_entered, new_entered
+  };
+  while (depth > 0) {
+    MoonBitTSTreeDiffFrame *frame = &stack[depth - 1];
+    if (!frame->old_live && !frame->new_live) {
+      if (frame->old_entered) {
+        ts_tree_cursor_goto_parent(old_cursor);
+      }
+      if (frame->new_entered) {
+        ts_tree_cursor_goto_parent(new_cursor);
+      }
+      depth--;
+      if (depth > 0) {
+        // Both cursors are back on the matched pair we descended into.
+        frame = &stack[depth - 1];
+        frame->old_live = ts_tree_cursor_goto_next_sibling(old_cursor);
+        frame->new_live = ts_tree_cursor_goto_next_sibling(new_cursor);
+      }
+      continue;
+    }
+    TSNode old_node = ts_tree_cursor_current_node(old_cursor);
+    TSNode new_node = ts_tree_cursor_current_node(new_cursor);
+    if (!frame->new_live) {
+      moonbit_ts_tree_diff_push(
+        diff, MoonBitTSNodeDiffRemoved, old_node, new_node
+      );
+      frame->old_live = ts_tree_cursor_goto_next_sibling(old_cursor);
+      continue;
+    }
+    if (!frame->old_live) {
+      moonbit_ts_tree_diff_push(
+        diff, MoonBitTSNodeDiffInserted, old_node, new_node
+      );
+      frame->new_live = ts_tree_cursor_goto_next_sibling(new_cursor);
+      continue;
+    }
+    uint32_t old_start = ts_node_start_byte(old_node);
+    uint32_t new_start = ts_node_start_byte(new_node);
+    if (moonbit_ts_node_is_reused(old_node, new_node)) {
+      frame->old_live = ts_tree_cursor_goto_next_sibling(old_cursor);
+      frame->new_live = ts_tree_cursor_goto_next_sibling(new_cursor);
+    } else if (ts_node_symbol(old_node) == ts_node_symbol(new_node) &&
+               old_start == new_start) {
+      if (ts_node_child_count(old_node) > 0 &&
+          ts_node_child_count(new_node) > 0) {
+        if (depth == capacity) {
+          capacity *= 2;
+          MOONBIT_TS_STATS_ALLOCATION();
+          stack = (MoonBitTSTreeDiffFrame *)realloc(
+            stack, capacity * sizeof(MoonBitTSTreeDiffFrame)
+          );
+        }
+        ts_tree_cursor_goto_first_child(old_cursor);
+        ts_tree_cursor_goto_first_child(new_cursor);
+        stack[depth++] = (MoonBitTSTreeDiffFrame){true, true, true, true};
+        continue;
+      }
+      if (ts_node_has_changes(old_node) ||
+          ts_node_end_byte(old_node) != ts_node_end_byte(new_node) ||
+          ts_node_child_count(old_node) != ts_node_child_count(new_node)) {
+        moonbit_ts_tree_diff_push(
+          diff, MoonBitTSNodeDiffUpdated, old_node, new_node
+        );
+      }
+      frame->old_live = ts_tree_cursor_goto_next_sibling(old_cursor);
+      frame->new_live = ts_tree_cursor_goto_next_sibling(new_cursor);
+    } else if (old_start < new_start) {
+      moonbit_ts_tree_diff_push(
+        diff, MoonBitTSNodeDiffRemoved, old_node, new_node
+      );
+      frame->old_live = ts_tree_cursor_goto_next_sibling(old_cursor);
+    } else if (new_start < old_start) {
+      moonbit_ts_tree_diff_push(
+        diff, MoonBitTSNodeDiffInserted, old_node, new_node
+      );
+      frame->new_live = ts_tree_cursor_goto_next_sibling(new_cursor);
+    } else {
+      moonbit_ts_tree_diff_push(
+        diff, MoonBitTSNodeDiffRemoved, old_node, new_node
+      );
+      moonbit_ts_tree_diff_push(
+        diff, MoonBitTSNodeDiffInserted, old_node, new_node
+      );
+      frame->old_live = ts_tree_cursor_goto_next_sibling(old_cursor);
+      frame->new_live = ts_tree_cursor_goto_next_sibling(new_cursor);
+    }
+  }
+  free(stack);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSTreeDiff *
+moonbit_ts_tree_diff(MoonBitTSTree *old_tree, MoonBitTSTree *new_tree) {
+  MOONBIT_TS_STATS_CALL();
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSTreeDiff *diff = (MoonBitTSTreeDiff *)moonbit_make_external_object(
+    moonbit_ts_tree_diff_delete, sizeof(MoonBitTSTreeDiff)
+  );
+  diff->records = NULL;
+  diff->count = 0;
+  diff->capacity = 0;
+  TSNode old_root = ts_tree_root_node(old_tree->tree);
+  TSNode new_root = ts_tree_root_node(new_tree->tree);
+  if (moonbit_ts_node_is_reused(old_root, new_root)) {
+    return diff;
+  }
+  if (ts_node_symbol(old_root) != ts_node_symbol(new_root)) {
+    moonbit_ts_tree_diff_push(
+      diff, MoonBitTSNodeDiffRemoved, old_root, new_root
+    );
+    moonbit_ts_tree_diff_push(
+      diff, MoonBitTSNodeDiffInserted, old_root, new_root
+    );
+    return diff;
+  }
+  TSTreeCursor old_cursor = ts_tree_cursor_new(old_root);
+  TSTreeCursor new_cursor = ts_tree_cursor_new(new_root);
+  moonbit_ts_tree_diff_walk(diff, &old_cursor, &new_cursor);
+  ts_tree_cursor_delete(&old_cursor);
+  ts_tree_cursor_delete(&new_cursor);
+  return diff;
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_tree_diff_count(MoonBitTSTreeDiff *self) {
+  MOONBIT_TS_STATS_CALL();
+  return self->count;
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_tree_diff_kind(MoonBitTSTreeDiff *self, uint32_t index) {
+  MOONBIT_TS_STATS_CALL();
+  return self->records[index].kind;
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNode *
+moonbit_ts_tree_diff_old_node(MoonBitTSTreeDiff *self, uint32_t index) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_node_new(self->records[index].old_node);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSNode *
+moonbit_ts_tree_diff_new_node(MoonBitTSTreeDiff *self, uint32_t index) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_node_new(self->records[index].new_node);
+}
+
+// A symbol set is a bitset over `TSSymbol`, stored as 32-bit words. The last
+// bit is reserved for `ts_builtin_sym_error`. A NULL set contains every symbol.
+typedef struct MoonBitTSSymbolSet {
+  uint32_t *words;
+  uint32_t length;
+} MoonBitTSSymbolSet;
+
+static inline MoonBitTSSymbolSet
+moonbit_ts_symbol_set_copy(uint32_t *words) {
+  MoonBitTSSymbolSet set = {.words = NULL, .length = 0};
+  if (words) {
+    set.length = Moonbit_array_length(words);
+    MOONBIT_TS_STATS_ALLOCATION();
+    set.words = (uint32_t *)malloc(set.length * sizeof(uint32_t) + 1);
+    memcpy(set.words, words, set.length * sizeof(uint32_t));
+  }
+  return set;
+}
+
+static inline bool
+moonbit_ts_symbol_set_contains(const MoonBitTSSymbolSet *set, TSSymbol symbol) {
+  if (!set->words) {
+    return true;
+  }
+  uint32_t last = set->length * 32 - 1;
+  uint32_t bit = symbol == ts_builtin_sym_error ? last : symbol;
+  if (set->length == 0 || (bit >= last && symbol != ts_builtin_sym_error)) {
+    return false;
+  }
+  return (set->words[bit >> 5] >> (bit & 31)) & 1;
+}
+
+typedef enum MoonBitTSTraversalOrder {
+  MoonBitTSTraversalPreOrder,
+  MoonBitTSTraversalPostOrder,
+} MoonBitTSTraversalOrder;
+
+typedef struct MoonBitTSTraversal {
+  TSTreeCursor cursor;
+  MoonBitTSTraversalOrder order;
+  MoonBitTSSymbolSet filter;
+  MoonBitTSSymbolSet prune;
+  bool started;
+  bool done;
+  TSNode *batch;
+  uint32_t batch_length;
+  uint32_t batch_capacity;
+} MoonBitTSTraversal;
+
+static inline void
+moonbit_ts_traversal_delete(void *object) {
+  MoonBitTSTraversal *self = (MoonBitTSTraversal *)object;
+  ts_tree_cursor_delete(&self->cursor);
+  free(self->filter.words);
+  free(self->prune.words);
+  free(self->batch);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSTraversal *
+moonbit_ts_traversal_new(
+  MoonBitTSNode *node,
+  MoonBitTSTree *tree,
+  MoonBitTSTraversalOrder order,
+  uint32_t *filter,
+  uint32_t *prune,
+  uint32_t batch_capacity
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(tree);
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSTraversal *self = (MoonBitTSTraversal *)moonbit_make_external_object(
+    moonbit_ts_traversal_delete, sizeof(MoonBitTSTraversal)
+  );
+  self->cursor = ts_tree_cursor_new(node->node);
+  self->order = order;
+  self->filter = moonbit_ts_symbol_set_copy(filter);
+  self->prune = moonbit_ts_symbol_set_copy(prune);
+  self->started = false;
+  self->done = false;
+  self->batch_capacity = batch_capacity > 0 ? batch_capacity : 1;
+  MOONBIT_TS_STATS_ALLOCATION();
+  self->batch = (TSNode *)malloc(self->batch_capacity * sizeof(TSNode));
+  self->batch_length = 0;
+  return self;
+}
+
+static inline bool
+moonbit_ts_traversal_is_pruned(MoonBitTSTraversal *self) {
+  if (!self->prune.words) {
+    return false;
+  }
+  TSNode node = ts_tree_cursor_current_node(&self->cursor);
+  return moonbit_ts_symbol_set_contains(&self->prune, ts_node_symbol(node));
+}
+
+static inline void
+moonbit_ts_traversal_goto_leftmost(MoonBitTSTraversal *self) {
+  while (!moonbit_ts_traversal_is_pruned(self) &&
+         ts_tree_cursor_goto_first_child(&self->cursor)) {
+  }
+}
+
+// Move the cursor to the next node in the traversal order, returning false
+// once the whole subtree has been visited.
+static inline bool
+moonbit_ts_traversal_advance(MoonBitTSTraversal *self) {
+  TSTreeCursor *cursor = &self->cursor;
+  if (self->order == MoonBitTSTraversalPostOrder) {
+    if (!self->started) {
+      self->started = true;
+      moonbit_ts_traversal_goto_leftmost(self);
+      return true;
+    }
+    if (ts_tree_cursor_goto_next_sibling(cursor)) {
+      moonbit_ts_traversal_goto_leftmost(self);
+      return true;
+    }
+    return ts_tree_cursor_goto_parent(cursor);
+  }
+  if (!self->started) {
+    self->started = true;
+    return true;
+  }
+  if (!moonbit_ts_traversal_is_pruned(self) &&
+      ts_tree_cursor_goto_first_child(cursor)) {
+    return true;
+  }
+  while (!ts_tree_cursor_goto_next_sibling(cursor)) {
+    if (!ts_tree_cursor_goto_parent(cursor)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Get the next matching nodes in one array of up to `batch_capacity` nodes.
+// An empty array means the traversal is over.
+MOONBIT_FFI_EXPORT
+MoonBitTSNode **
+moonbit_ts_traversal_next_batch(MoonBitTSTraversal *self) {
+  MOONBIT_TS_STATS_CALL();
+  self->batch_length = 0;
+  while (!self->done && self->batch_length < self->batch_capacity) {
+    if (!moonbit_ts_traversal_advance(self)) {
+      self->done = true;
+      break;
+    }
+    TSNode node = ts_tree_cursor_current_node(&self->cursor);
+    if (moonbit_ts_symbol_set_contains(&self->filter, ts_node_symbol(node))) {
+      self->batch[self->batch_length++] = node;
+    }
+  }
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSNode **nodes =
+    (MoonBitTSNode **)moonbit_make_ref_array(self->batch_length, NULL);
+  for (uint32_t i = 0; i < self->batch_length; i++) {
+    nodes[i] = moonbit_ts_node_new(self->batch[i]);
+  }
+  return nodes;
+}
+
+// A growable byte buffer used by the native writers.
+typedef struct MoonBitTSBuffer {
+  uint8_t *data;
+  size_t length;
+  size_t capacity;
+} MoonBitTSBuffer;
+
+static inline void
+moonbit_ts_buffer_reserve(MoonBitTSBuffer *self, size_t additional) {
+  if (self->length + additional <= self->capacity) {
+    return;
+  }
+  size_t capacity = self->capacity ? self->capacity : 256;
+  while (capacity < self->length + additional) {
+    capacity *= 2;
+  }
+  MOONBIT_TS_STATS_ALLOCATION();
+  self->data = (uint8_t *)realloc(self->data, capacity);
+  self->capacity = capacity;
+}
+
+static inline void
+moonbit_ts_buffer_push(MoonBitTSBuffer *self, const void *data, size_t length) {
+  moonbit_ts_buffer_reserve(self, length);
+  memcpy(self->data + self->length, data, length);
+  self->length += length;
+}
+
+static inline void
+moonbit_ts_buffer_push_byte(MoonBitTSBuffer *self, uint8_t byte) {
+  moonbit_ts_buffer_reserve(self, 1);
+  self->data[self->length++] = byte;
+}
+
+static inline void
+moonbit_ts_buffer_push_string(MoonBitTSBuffer *self, const char *string) {
+  moonbit_ts_buffer_push(self, string, strlen(string));
+}
+
+static inline void
+moonbit_ts_buffer_push_varint(MoonBitTSBuffer *self, uint32_t value) {
+  while (value >= 0x80) {
+    moonbit_ts_buffer_push_byte(self, (uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  moonbit_ts_buffer_push_byte(self, (uint8_t)value);
+}
+
+static inline void
+moonbit_ts_buffer_set_u32(
+  MoonBitTSBuffer *self,
+  size_t offset,
+  uint32_t value
+) {
+  for (int i = 0; i < 4; i++) {
+    self->data[offset + i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static inline moonbit_bytes_t
+moonbit_ts_buffer_to_bytes(MoonBitTSBuffer *self) {
+  MOONBIT_TS_STATS_ALLOCATION();
+  moonbit_bytes_t bytes = moonbit_make_bytes_sz(self->length, 0);
+  if (self->length > 0) {
+    memcpy(bytes, self->data, self->length);
+  }
+  free(self->data);
+  self->data = NULL;
+  self->length = self->capacity = 0;
+  return bytes;
+}
+
+// Binary tree format, version 1. Integers are LEB128 varints unless noted.
+//
+//   header   "TSBT", u8 version, u8 flags (bit 0: has text)
+//   string   language name                 (varint length, then bytes)
+//   symbols  count, then (symbol, name) for each symbol used by the tree
+//   fields   count, then (field id, name) for each field used by the tree
+//   nodes    count
+//   text     present if flagged, as a string
+//   records  one per node, in pre-order
+//
+// A node record refers to symbols and fields by their index in the tables
+// above, and stores its position relative to its parent's start:
+//
+//   symbol index, u8 flags (MOONBIT_TS_SERIALIZED_*), field index if flagged,
+//   start byte - parent start byte, end byte - start byte,
+//   start row - parent start row, start column (relative to the parent's
+//   start column if on the same row), end row - start row, end column
+//   (relative to the start column if on the same row), child count,
+//   u32 little-endian size in bytes of the descendants' records.
+//
+// The trailing size lets readers skip a whole subtree in O(1).
+#define MOONBIT_TS_SERIALIZED_VERSION 1
+#define MOONBIT_TS_SERIALIZED_HAS_TEXT 1
+#define MOONBIT_TS_SERIALIZED_NAMED (1 << 0)
+#define MOONBIT_TS_SERIALIZED_EXTRA (1 << 1)
+#define MOONBIT_TS_SERIALIZED_MISSING (1 << 2)
+#define MOONBIT_TS_SERIALIZED_ERROR (1 << 3)
+#define MOONBIT_TS_SERIALIZED_HAS_ERROR (1 << 4)
+#define MOONBIT_TS_SERIALIZED_HAS_FIELD (1 << 5)
+
+typedef struct MoonBitTSSerializeFrame {
+  size_t size_offset;
+  uint32_t start_byte;
+  TSPoint start_point;
+} MoonBitTSSerializeFrame;
+
+typedef struct MoonBitTSSerializer {
+  const TSLanguage *language;
+  uint32_t symbol_count;
+  uint32_t *symbol_index;
+  uint32_t *field_index;
+  MoonBitTSBuffer symbols;
+  uint32_t used_symbols;
+  MoonBitTSBuffer fields;
+  uint32_t used_fields;
+  MoonBitTSBuffer records;
+  uint32_t node_count;
+} MoonBitTSSerializer;
+
+static inline uint32_t
+moonbit_ts_serializer_symbol(MoonBitTSSerializer *self, TSSymbol symbol) {
+  // The error symbols live at the top of the symbol space.
+  uint32_t slot = symbol < self->symbol_count
+                    ? symbol
+                    : self->symbol_count +
+                        (uint16_t)(symbol - ts_builtin_sym_error_repeat);
+  if (self->symbol_index[slot] == UINT32_MAX) {
+    const char *name = ts_language_symbol_name(self->language, symbol);
+    name = name ? name : "";
+    self->symbol_index[slot] = self->used_symbols++;
+    moonbit_ts_buffer_push_varint(&self->symbols, symbol);
+    moonbit_ts_buffer_push_varint(&self->symbols, strlen(name));
+    moonbit_ts_buffer_push_string(&self->symbols, name);
+  }
+  return self->symbol_index[slot];
+}
+
+static inline uint32_t
+moonbit_ts_serializer_field(MoonBitTSSerializer *self, TSFieldId field) {
+  if (self->field_index[field] == UINT32_MAX) {
+    const char *name = ts_language_field_name_for_id(self->language, field);
+    name = name ? name : "";
+    self->field_index[field] = self->used_fields++;
+    moonbit_ts_buffer_push_varint(&self->fields, field);
+    moonbit_ts_buffer_push_varint(&self->fields, strlen(name));
+    moonbit_ts_buffer_push_string(&self->fields, name);
+  }
+  return self->field_index[field];
+}
+
+static void
+moonbit_ts_serializer_write_node(
+  MoonBitTSSerializer *self,
+  TSTreeCursor *cursor,
+  const MoonBitTSSerializeFrame *parent,
+  MoonBitTSSerializeFrame *frame
+) {
+  MoonBitTSBuffer *records = &self->records;
+  TSNode node = ts_tree_cursor_current_node(cursor);
+  TSFieldId field = ts_tree_cursor_current_field_id(cursor);
+  uint32_t start_byte = ts_node_start_byte(node);
+  uint32_t end_byte = ts_node_end_byte(node);
+  TSPoint start = ts_node_start_point(node);
+  TSPoint end = ts_node_end_point(node);
+  uint8_t flags = 0;
+  flags |= ts_node_is_named(node) ? MOONBIT_TS_SERIALIZED_NAMED : 0;
+  flags |= ts_node_is_extra(node) ? MOONBIT_TS_SERIALIZED_EXTRA : 0;
+  flags |= ts_node_is_missing(node) ? MOONBIT_TS_SERIALIZED_MISSING : 0;
+  flags |= ts_node_is_error(node) ? MOONBIT_TS_SERIALIZED_ERROR : 0;
+  flags |= ts_node_has_error(node) ? MOONBIT_TS_SERIALIZED_HAS_ERROR : 0;
+  flags |= field ? MOONBIT_TS_SERIALIZED_HAS_FIELD : 0;
+  moonbit_ts_buffer_push_varint(
+    records, moonbit_ts_serializer_symbol(self, ts_node_symbol(node))
+  );
+  moonbit_ts_buffer_push_byte(records, flags);
+  if (field) {
+    moonbit_ts_buffer_push_varint(
+      records, moonbit_ts_serializer_field(self, field)
+    );
+  }
+  TSPoint parent_start = parent ? parent->start_point : (TSPoint){0, 0};
+  uint32_t parent_start_byte = parent ? parent->start_byte : 0;
+  moonbit_ts_buffer_push_varint(records, start_byte - parent_start_byte);
+  moonbit_ts_buffer_push_varint(records, end_byte - start_byte);
+  moonbit_ts_buffer_push_varint(records, start.row - parent_start.row);
+  moonbit_ts_buffer_push_varint(
+    records,
+    start.row == parent_start.row ? start.column - parent_start.column
+                                  : start.column
+  );
+  moonbit_ts_buffer_push_varint(records, end.row - start.row);
+  moonbit_ts_buffer_push_varint(
+    records, end.row == start.row ? end.column - start.column : end.column
+  );
+  moonbit_ts_buffer_push_varint(records, ts_node_child_count(node));
+  frame->size_offset = records->length;
+  frame->start_byte = start_byte;
+  frame->start_point = start;
+  moonbit_ts_buffer_reserve(records, 4);
+  records->length += 4;
+  self->node_count++;
+}
+
+static void
+moonbit_ts_serializer_finish_node(
+  MoonBitTSSerializer *self,
+  const MoonBitTSSerializeFrame *frame
+) {
+  size_t size = self->records.length - (frame->size_offset + 4);
+  moonbit_ts_buffer_set_u32(
+    &self->records, frame->size_offset, moonbit_size_to_uint(size)
+  );
+}
+
+static MoonBitTSBuffer
+moonbit_ts_tree_serialize_to_buffer(MoonBitTSTree *tree, moonbit_bytes_t text) {
+  MoonBitTSSerializer self = {0};
+  self.language = ts_tree_language(tree->tree);
+  self.symbol_count = ts_language_symbol_count(self.language);
+  uint32_t field_count = ts_language_field_count(self.language);
+  MOONBIT_TS_STATS_ALLOCATION();
+  self.symbol_index =
+    (uint32_t *)malloc((self.symbol_count + 2) * sizeof(uint32_t));
+  memset(self.symbol_index, 0xff, (self.symbol_count + 2) * sizeof(uint32_t));
+  MOONBIT_TS_STATS_ALLOCATION();
+  self.field_index = (uint32_t *)malloc((field_count + 1) * sizeof(uint32_t));
+  memset(self.field_index, 0xff, (field_count + 1) * sizeof(uint32_t));
+
+  uint32_t depth = 0;
+  uint32_t capacity = 64;
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSSerializeFrame *stack = (MoonBitTSSerializeFrame *)malloc(
+    capacity * sizeof(MoonBitTSSerializeFrame)
+  );
+  TSTreeCursor cursor = ts_tree_cursor_new(ts_tree_root_node(tree->tree));
+  moonbit_ts_serializer_write_node(&self, &cursor, NULL, &stack[depth++]);
+  while (depth > 0) {
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+      if (depth == capacity) {
+        capacity *= 2;
+        MOONBIT_TS_STATS_ALLOCATION();
+        stack = (MoonBitTSSerializeFrame *)realloc(
+          stack, capacity * sizeof(MoonBitTSSerializeFrame)
+        );
+      }
+      moonbit_ts_serializer_write_node(
+        &self, &cursor, &stack[depth - 1], &stack[depth]
+      );
+      depth++;
+      continue;
+    }
+    while (depth > 0) {
+      moonbit_ts_serializer_finish_node(&self, &stack[--depth]);
+      if (depth == 0) {
+        break;
+      }
+      if (ts_tree_cursor_goto_next_sibling(&cursor)) {
+        moonbit_ts_serializer_write_node(
+          &self, &cursor, &stack[depth - 1], &stack[depth]
+        );
+        depth++;
+        break;
+      }
+      ts_tree_cursor_goto_parent(&cursor);
+    }
+  }
+  ts_tree_cursor_delete(&cursor);
+  free(stack);
+  free(self.symbol_index);
+  free(self.field_index);
+
+  MoonBitTSBuffer output = {0};
+  const char *name = ts_language_name(self.language);
+  name = name ? name : "";
+  moonbit_ts_buffer_push(&output, "TSBT", 4);
+  moonbit_ts_buffer_push_byte(&output, MOONBIT_TS_SERIALIZED_VERSION);
+  moonbit_ts_buffer_push_byte(
+    &output, text ? MOONBIT_TS_SERIALIZED_HAS_TEXT : 0
+  );
+  moonbit_ts_buffer_push_varint(&output, strlen(name));
+  moonbit_ts_buffer_push_string(&output, name);
+  moonbit_ts_buffer_push_varint(&output, self.used_symbols);
+  moonbit_ts_buffer_push(&output, self.symbols.data, self.symbols.length);
+  moonbit_ts_buffer_push_varint(&output, self.used_fields);
+  moonbit_ts_buffer_push(&output, self.fields.data, self.fields.length);
+  moonbit_ts_buffer_push_varint(&output, self.node_count);
+  if (text) {
+    uint32_t length = Moonbit_array_length(text);
+    moonbit_ts_buffer_push_varint(&output, length);
+    moonbit_ts_buffer_push(&output, text, length);
+  }
+  moonbit_ts_buffer_push(&output, self.records.data, self.records.length);
+  free(self.symbols.data);
+  free(self.fields.data);
+  free(self.records.data);
+  return output;
+}
+
+MOONBIT_FFI_EXPORT
+moonbit_bytes_t
+moonbit_ts_tree_serialize(MoonBitTSTree *tree, moonbit_bytes_t text) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSBuffer buffer = moonbit_ts_tree_serialize_to_buffer(tree, text);
+  return moonbit_ts_buffer_to_bytes(&buffer);
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_tree_serialize_to_file(
+  MoonBitTSTree *tree,
+  moonbit_bytes_t text,
+  moonbit_bytes_t path
+) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSBuffer buffer = moonbit_ts_tree_serialize_to_buffer(tree, text);
+  FILE *file = fopen((const char *)path, "wb");
+  bool ok = file != NULL;
+  if (file) {
+    ok = fwrite(buffer.data, 1, buffer.length, file) == buffer.length;
+    ok = fclose(file) == 0 && ok;
+  }
+  free(buffer.data);
+  return ok;
+}
+
+typedef struct MoonBitTSReader {
+  const uint8_t *data;
+  size_t length;
+  size_t offset;
+  bool error;
+} MoonBitTSReader;
+
+static inline uint8_t
+moonbit_ts_reader_byte(MoonBitTSReader *self) {
+  if (self->offset >= self->length) {
+    self->error = true;
+    return 0;
+  }
+  return self->data[self->offset++];
+}
+
+static inline uint32_t
+moonbit_ts_reader_varint(MoonBitTSReader *self) {
+  uint32_t value = 0;
+  for (uint32_t shift = 0; shift < 35; shift += 7) {
+    uint8_t byte = moonbit_ts_reader_byte(self);
+    value |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  self->error = true;
+  return 0;
+}
+
+static inline uint32_t
+moonbit_ts_reader_u32(MoonBitTSReader *self) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= (uint32_t)moonbit_ts_reader_byte(self) << (8 * i);
+  }
+  return value;
+}
+
+// A string inside the serialized data, as an offset and a length.
+typedef struct MoonBitTSSerializedString {
+  uint32_t offset;
+  uint32_t length;
+} MoonBitTSSerializedString;
+
+static inline MoonBitTSSerializedString
+moonbit_ts_reader_string(MoonBitTSReader *self) {
+  MoonBitTSSerializedString string = {0, 0};
+  uint32_t length = moonbit_ts_reader_varint(self);
+  if (self->error || length > self->length - self->offset) {
+    self->error = true;
+    return string;
+  }
+  string.offset = moonbit_size_to_uint(self->offset);
+  string.length = length;
+  self->offset += length;
+  return string;
+}
+
+typedef struct MoonBitTSSerializedEntry {
+  uint32_t id;
+  MoonBitTSSerializedString name;
+} MoonBitTSSerializedEntry;
+
+typedef struct MoonBitTSSerializedTree {
+  const uint8_t *data;
+  size_t length;
+  bool mapped;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#endif
+  MoonBitTSSerializedString language_name;
+  MoonBitTSSerializedString text;
+  bool has_text;
+  uint32_t symbol_count;
+  MoonBitTSSerializedEntry *symbols;
+  uint32_t field_count;
+  MoonBitTSSerializedEntry *fields;
+  uint32_t node_count;
+  uint32_t root_offset;
+} MoonBitTSSerializedTree;
+
+static inline void
+moonbit_ts_serialized_tree_delete(void *object) {
+  MoonBitTSSerializedTree *self = (MoonBitTSSerializedTree *)object;
+  free(self->symbols);
+  free(self->fields);
+  if (!self->data) {
+    return;
+  }
+  if (!self->mapped) {
+    free((void *)self->data);
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(self->data);
+  CloseHandle(self->mapping);
+  CloseHandle(self->file);
+#else
+  munmap((void *)self->data, self->length);
+#endif
+}
+
+static inline MoonBitTSSerializedEntry *
+moonbit_ts_reader_entries(MoonBitTSReader *reader, uint32_t *count) {
+  *count = moonbit_ts_reader_varint(reader);
+  // Every entry takes at least two bytes.
+  if (reader->error || *count > (reader->length - reader->offset) / 2) {
+    reader->error = true;
+    *count = 0;
+    return NULL;
+  }
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSSerializedEntry *entries = (MoonBitTSSerializedEntry *)malloc(
+    (*count + 1) * sizeof(MoonBitTSSerializedEntry)
+  );
+  for (uint32_t i = 0; i < *count; i++) {
+    entries[i].id = moonbit_ts_reader_varint(reader);
+    entries[i].name = moonbit_ts_reader_string(reader);
+  }
+  return entries;
+}
+
+// Parse the header of the data attached to `self`. Returns false if the data
+// is not a serialized tree of a supported version.
+static bool
+moonbit_ts_serialized_tree_load(MoonBitTSSerializedTree *self) {
+  MoonBitTSReader reader = {self->data, self->length, 0, false};
+  if (self->length < 6 || memcmp(self->data, "TSBT", 4) != 0) {
+    return false;
+  }
+  reader.offset = 4;
+  if (moonbit_ts_reader_byte(&reader) != MOONBIT_TS_SERIALIZED_VERSION) {
+    return false;
+  }
+  uint8_t flags = moonbit_ts_reader_byte(&reader);
+  self->language_name = moonbit_ts_reader_string(&reader);
+  self->symbols = moonbit_ts_reader_entries(&reader, &self->symbol_count);
+  self->fields = moonbit_ts_reader_entries(&reader, &self->field_count);
+  self->node_count = moonbit_ts_reader_varint(&reader);
+  self->has_text = flags & MOONBIT_TS_SERIALIZED_HAS_TEXT;
+  if (self->has_text) {
+    self->text = moonbit_ts_reader_string(&reader);
+  }
+  if (reader.error || reader.offset >= reader.length) {
+    return false;
+  }
+  self->root_offset = moonbit_size_to_uint(reader.offset);
+  return true;
+}
+
+static inline MoonBitTSSerializedTree *
+moonbit_ts_serialized_tree_new(void) {
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSSerializedTree *self =
+    (MoonBitTSSerializedTree *)moonbit_make_external_object(
+      moonbit_ts_serialized_tree_delete, sizeof(MoonBitTSSerializedTree)
+    );
+  memset(self, 0, sizeof(MoonBitTSSerializedTree));
+  return self;
+}
+
+// Returns NULL if the bytes are not a serialized tree.
+MOONBIT_FFI_EXPORT
+MoonBitTSSerializedTree *
+moonbit_ts_serialized_tree_from_bytes(moonbit_bytes_t bytes) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSSerializedTree *self = moonbit_ts_serialized_tree_new();
+  size_t length = Moonbit_array_length(bytes);
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint8_t *data = (uint8_t *)malloc(length > 0 ? length : 1);
+  memcpy(data, bytes, length);
+  self->data = data;
+  self->length = length;
+  if (!moonbit_ts_serialized_tree_load(self)) {
+    moonbit_decref(self);
+    return NULL;
+  }
+  return self;
+}
+
+// Map the file at `path` read-only into memory. Returns NULL if the file
+// cannot be mapped, and sets `*malformed` if it is not a serialized tree.
+MOONBIT_FFI_EXPORT
+MoonBitTSSerializedTree *
+moonbit_ts_serialized_tree_open(moonbit_bytes_t path, int32_t *malformed) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSSerializedTree *self = moonbit_ts_serialized_tree_new();
+  *malformed = false;
+#ifdef _WIN32
+  self->file = CreateFileA(
+    (const char *)path,
+    GENERIC_READ,
+    FILE_SHARE_READ,
+    NULL,
+    OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL,
+    NULL
+  );
+  if (self->file == INVALID_HANDLE_VALUE) {
+    moonbit_decref(self);
+    return NULL;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(self->file, &size) || size.QuadPart == 0) {
+    CloseHandle(self->file);
+    *malformed = true;
+    moonbit_decref(self);
+    return NULL;
+  }
+  self->mapping =
+    CreateFileMappingA(self->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  const uint8_t *data =
+    self->mapping ? MapViewOfFile(self->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+  if (!data) {
+    if (self->mapping) {
+      CloseHandle(self->mapping);
+    }
+    CloseHandle(self->file);
+    moonbit_decref(self);
+    return NULL;
+  }
+  self->length = (size_t)size.QuadPart;
+#else
+  int fd = open((const char *)path, O_RDONLY);
+  if (fd < 0) {
+    moonbit_decref(self);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    *malformed = true;
+    moonbit_decref(self);
+    return NULL;
+  }
+  const uint8_t *data = (const uint8_t *)mmap(
+    NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0
+  );
+  close(fd);
+  if (data == MAP_FAILED) {
+    moonbit_decref(self);
+    return NULL;
+  }
+  self->length = (size_t)st.st_size;
+#endif
+  self->data = data;
+  self->mapped = true;
+  if (!moonbit_ts_serialized_tree_load(self)) {
+    *malformed = true;
+    moonbit_decref(self);
+    return NULL;
+  }
+  return self;
+}
+
+static inline moonbit_bytes_t
+moonbit_ts_serialized_tree_string(
+  MoonBitTSSerializedTree *self,
+  MoonBitTSSerializedString string
+) {
+  MOONBIT_TS_STATS_ALLOCATION();
+  moonbit_bytes_t bytes = moonbit_make_bytes(string.length, 0);
+  memcpy(bytes, self->data + string.offset, string.length);
+  return bytes;
+}
+
+MOONBIT_FFI_EXPORT
+moonbit_bytes_t
+moonbit_ts_serialized_tree_language_name(MoonBitTSSerializedTree *self) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_serialized_tree_string(self, self->language_name);
+}
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_serialized_tree_has_text(MoonBitTSSerializedTree *self) {
+  MOONBIT_TS_STATS_CALL();
+  return self->has_text;
+}
+
+MOONBIT_FFI_EXPORT
+moonbit_bytes_t
+moonbit_ts_serialized_tree_text(MoonBitTSSerializedTree *self) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_serialized_tree_string(self, self->text);
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_serialized_tree_node_count(MoonBitTSSerializedTree *self) {
+  MOONBIT_TS_STATS_CALL();
+  return self->node_count;
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_serialized_tree_symbol_count(MoonBitTSSerializedTree *self) {
+  MOONBIT_TS_STATS_CALL();
+  return self->symbol_count;
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_serialized_tree_symbol(
+  MoonBitTSSerializedTree *self,
+  uint32_t index
+) {
+  MOONBIT_TS_STATS_CALL();
+  return self->symbols[index].id;
+}
+
+MOONBIT_FFI_EXPORT
+moonbit_bytes_t
+moonbit_ts_serialized_tree_symbol_name(
+  MoonBitTSSerializedTree *self,
+  uint32_t index
+) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_serialized_tree_string(self, self->symbols[index].name);
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_serialized_tree_field_count(MoonBitTSSerializedTree *self) {
+  MOONBIT_TS_STATS_CALL();
+  return self->field_count;
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_serialized_tree_field(
+  MoonBitTSSerializedTree *self,
+  uint32_t index
+) {
+  MOONBIT_TS_STATS_CALL();
+  return self->fields[index].id;
+}
+
+MOONBIT_FFI_EXPORT
+moonbit_bytes_t
+moonbit_ts_serialized_tree_field_name(
+  MoonBitTSSerializedTree *self,
+  uint32_t index
+) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_serialized_tree_string(self, self->fields[index].name);
+}
+
+MOONBIT_FFI_EXPORT
+uint32_t
+moonbit_ts_serialized_tree_root_offset(MoonBitTSSerializedTree *self) {
+  MOONBIT_TS_STATS_CALL();
+  return self->root_offset;
+}
+
+// Decode the node record at `offset`, given the absolute start of its parent
+// as `[start_byte, start_row, start_column]`. The result is laid out as
+// `[symbol index, flags, field index, start_byte, end_byte, start_row,
+// start_column, end_row, end_column, child_count, first child offset,
+// next sibling offset]`, or is NULL if the record is malformed.
+MOONBIT_FFI_EXPORT
+uint32_t *
+moonbit_ts_serialized_tree_decode(
+  MoonBitTSSerializedTree *self,
+  uint32_t offset,
+  uint32_t *parent
+) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSReader reader = {self->data, self->length, offset, false};
+  uint32_t symbol = moonbit_ts_reader_varint(&reader);
+  uint8_t flags = moonbit_ts_reader_byte(&reader);
+  uint32_t field = UINT32_MAX;
+  if (flags & MOONBIT_TS_SERIALIZED_HAS_FIELD) {
+    field = moonbit_ts_reader_varint(&reader);
+  }
+  uint32_t start_byte = parent[0] + moonbit_ts_reader_varint(&reader);
+  uint32_t end_byte = start_byte + moonbit_ts_reader_varint(&reader);
+  uint32_t row_delta = moonbit_ts_reader_varint(&reader);
+  uint32_t start_row = parent[1] + row_delta;
+  uint32_t start_column = moonbit_ts_reader_varint(&reader);
+  start_column += row_delta == 0 ? parent[2] : 0;
+  uint32_t end_row_delta = moonbit_ts_reader_varint(&reader);
+  uint32_t end_row = start_row + end_row_delta;
+  uint32_t end_column = moonbit_ts_reader_varint(&reader);
+  end_column += end_row_delta == 0 ? start_column : 0;
+  uint32_t child_count = moonbit_ts_reader_varint(&reader);
+  uint32_t size = moonbit_ts_reader_u32(&reader);
+  if (reader.error || symbol >= self->symbol_count ||
+      (field != UINT32_MAX && field >= self->field_count) ||
+      size > reader.length - reader.offset) {
+    return NULL;
+  }
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *node = (uint32_t *)moonbit_make_int32_array(12, 0);
+  node[0] = symbol;
+  node[1] = flags;
+  node[2] = field;
+  node[3] = start_byte;
+  node[4] = end_byte;
+  node[5] = start_row;
+  node[6] = start_column;
+  node[7] = end_row;
+  node[8] = end_column;
+  node[9] = child_count;
+  node[10] = moonbit_size_to_uint(reader.offset);
+  node[11] = moonbit_size_to_uint(reader.offset + size);
+  return node;
+}
+
+typedef enum MoonBitTSSexpFlags {
+  MoonBitTSSexpPretty = 1 << 0,
+  MoonBitTSSexpFields = 1 << 1,
+  MoonBitTSSexpRanges = 1 << 2,
+} MoonBitTSSexpFlags;
+
+// One level of the S-expression walk: the column at which the children of the
+// node are indented, and whether the node left a parenthesis open.
+typedef struct MoonBitTSSexpLevel {
+  uint32_t indent;
+  bool open;
+} MoonBitTSSexpLevel;
+
+// Writes the S-expression of a subtree in chunks, resuming its cursor walk
+// where the previous chunk stopped, so that the whole string never has to be
+// held in memory at once.
+typedef struct MoonBitTSSexpWriter {
+  TSTreeCursor cursor;
+  uint32_t flags;
+  MoonBitTSSexpLevel *levels;
+  uint32_t depth;
+  uint32_t capacity;
+  bool started;
+  bool done;
+} MoonBitTSSexpWriter;
+
+static inline void
+moonbit_ts_sexp_writer_delete(void *object) {
+  MoonBitTSSexpWriter *self = (MoonBitTSSexpWriter *)object;
+  ts_tree_cursor_delete(&self->cursor);
+  free(self->levels);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSSexpWriter *
+moonbit_ts_sexp_writer_new(
+  MoonBitTSNode *node,
+  MoonBitTSTree *tree,
+  uint32_t flags
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(tree);
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSSexpWriter *self =
+    (MoonBitTSSexpWriter *)moonbit_make_external_object(
+      moonbit_ts_sexp_writer_delete, sizeof(MoonBitTSSexpWriter)
+    );
+  self->cursor = ts_tree_cursor_new(node->node);
+  self->flags = flags;
+  self->levels = NULL;
+  self->depth = 0;
+  self->capacity = 0;
+  self->started = false;
+  self->done = false;
+  return self;
+}
+
+static inline void
+moonbit_ts_sexp_writer_push_level(
+  MoonBitTSSexpWriter *self,
+  uint32_t indent,
+  bool open
+) {
+  if (self->depth == self->capacity) {
+    self->capacity = self->capacity ? self->capacity * 2 : 32;
+    MOONBIT_TS_STATS_ALLOCATION();
+    self->levels = (MoonBitTSSexpLevel *)realloc(
+      self->levels, self->capacity * sizeof(MoonBitTSSexpLevel)
+    );
+  }
+  self->levels[self->depth++] = (MoonBitTSSexpLevel){
+    .indent = indent, .open = open
+  };
+}
+
+static inline void
+moonbit_ts_sexp_writer_separate(
+  MoonBitTSSexpWriter *self,
+  MoonBitTSBuffer *buffer,
+  uint32_t indent
+) {
+  if (!(self->flags & MoonBitTSSexpPretty)) {
+    moonbit_ts_buffer_push_byte(buffer, ' ');
+    return;
+  }
+  moonbit_ts_buffer_reserve(buffer, indent + 1);
+  buffer->data[buffer->length++] = '\n';
+  memset(buffer->data + buffer->length, ' ', indent);
+  buffer->length += indent;
+}
+
+// Quote a string the way `String::escape` does, which is how `@sexp` prints
+// string atoms.
+static inline void
+moonbit_ts_buffer_push_quoted(
+  MoonBitTSBuffer *self,
+  const char *string,
+  size_t length
+) {
+  moonbit_ts_buffer_push_byte(self, '"');
+  for (size_t i = 0; i < length; i++) {
+    uint8_t byte = (uint8_t)string[i];
+    switch (byte) {
+    case '"':
+      moonbit_ts_buffer_push_string(self, "\\\"");
+      break;
+    case '\\':
+      moonbit_ts_buffer_push_string(self, "\\\\");
+      break;
+    case '\n':
+      moonbit_ts_buffer_push_string(self, "\\n");
+      break;
+    case '\r':
+      moonbit_ts_buffer_push_string(self, "\\r");
+      break;
+    case '\t':
+      moonbit_ts_buffer_push_string(self, "\\t");
+      break;
+    case '\b':
+      moonbit_ts_buffer_push_string(self, "\\b");
+      break;
+    default:
+      if (byte < 0x20) {
+        char escape[8];
+        int length = snprintf(escape, sizeof(escape), "\\u{%x}", byte);
+        moonbit_ts_buffer_push(self, escape, (size_t)length);
+      } else {
+        moonbit_ts_buffer_push_byte(self, byte);
+      }
+    }
+  }
+  moonbit_ts_buffer_push_byte(self, '"');
+}
+
+// The character an error leaf was stuck on is only reachable through
+// `ts_node_string`, which prints it as `(UNEXPECTED 'c')`, `(UNEXPECTED 10)`
+// or `(UNEXPECTED INVALID)`.
+static inline void
+moonbit_ts_sexp_writer_push_unexpected(MoonBitTSBuffer *buffer, TSNode node) {
+  char *string = ts_node_string(node);
+  const char *prefix = "(UNEXPECTED ";
+  size_t length = strlen(string);
+  size_t start = strlen(prefix);
+  if (length <= start || strncmp(string, prefix, start) != 0) {
+    moonbit_ts_buffer_push_string(buffer, "INVALID");
+    free(string);
+    return;
+  }
+  size_t end = length - 1;
+  const char *token = string + start;
+  size_t token_length = end - start;
+  if (token_length >= 3 && token[0] == '\'' &&
+      token[token_length - 1] == '\'') {
+    if (token_length == 3) {
+      moonbit_ts_buffer_push_quoted(buffer, token + 1, 1);
+    } else {
+      // Already escaped, e.g. `'\n'`.
+      moonbit_ts_buffer_push_byte(buffer, '"');
+      moonbit_ts_buffer_push(buffer, token + 1, token_length - 2);
+      moonbit_ts_buffer_push_byte(buffer, '"');
+    }
+  } else {
+    moonbit_ts_buffer_push(buffer, token, token_length);
+  }
+  free(string);
+}
+
+static inline void
+moonbit_ts_sexp_writer_push_range(
+  MoonBitTSSexpWriter *self,
+  MoonBitTSBuffer *buffer,
+  TSNode node
+) {
+  if (!(self->flags & MoonBitTSSexpRanges)) {
+    return;
+  }
+  char range[32];
+  int length = snprintf(
+    range, sizeof(range), " [%u, %u]", (unsigned)ts_node_start_byte(node),
+    (unsigned)ts_node_end_byte(node)
+  );
+  moonbit_ts_buffer_push(buffer, range, (size_t)length);
+}
+
+// Write the node under the cursor, following the visibility rules of
+// `ts_node_string`: the root and named or missing nodes are printed, while
+// anonymous nodes are skipped.
+static inline void
+moonbit_ts_sexp_writer_write_node(
+  MoonBitTSSexpWriter *self,
+  MoonBitTSBuffer *buffer
+) {
+  TSNode node = ts_tree_cursor_current_node(&self->cursor);
+  bool is_root = self->depth == 0;
+  uint32_t indent = is_root ? 0 : self->levels[self->depth - 1].indent;
+  bool is_named = ts_node_is_named(node);
+  bool is_missing = ts_node_is_missing(node);
+  if (!is_root && !is_named && !is_missing) {
+    moonbit_ts_sexp_writer_push_level(self, indent, false);
+    return;
+  }
+  if (!is_root) {
+    moonbit_ts_sexp_writer_separate(self, buffer, indent);
+    const char *field_name =
+      (self->flags & MoonBitTSSexpFields)
+        ? ts_tree_cursor_current_field_name(&self->cursor)
+        : NULL;
+    if (field_name) {
+      size_t length = strlen(field_name);
+      moonbit_ts_buffer_push(buffer, field_name, length);
+      moonbit_ts_buffer_push_string(buffer, ": ");
+      indent += (uint32_t)length + 2;
+    }
+  }
+  const char *type = ts_node_type(node);
+  if (is_missing) {
+    moonbit_ts_buffer_push_string(buffer, "(MISSING");
+    moonbit_ts_sexp_writer_separate(self, buffer, indent + 1);
+    if (is_named) {
+      moonbit_ts_buffer_push_string(buffer, type);
+    } else {
+      moonbit_ts_buffer_push_quoted(buffer, type, strlen(type));
+    }
+    moonbit_ts_sexp_writer_push_range(self, buffer, node);
+    moonbit_ts_buffer_push_byte(buffer, ')');
+    moonbit_ts_sexp_writer_push_level(self, indent + 1, false);
+    return;
+  }
+  if (ts_node_is_error(node) && ts_node_child_count(node) == 0 &&
+      ts_node_end_byte(node) > ts_node_start_byte(node)) {
+    moonbit_ts_buffer_push_string(buffer, "(UNEXPECTED");
+    moonbit_ts_sexp_writer_separate(self, buffer, indent + 1);
+    moonbit_ts_sexp_writer_push_unexpected(buffer, node);
+    moonbit_ts_sexp_writer_push_range(self, buffer, node);
+    moonbit_ts_buffer_push_byte(buffer, ')');
+    moonbit_ts_sexp_writer_push_level(self, indent + 1, false);
+    return;
+  }
+  moonbit_ts_buffer_push_byte(buffer, '(');
+  if (is_named) {
+    moonbit_ts_buffer_push_string(buffer, type);
+  } else {
+    moonbit_ts_buffer_push_quoted(buffer, type, strlen(type));
+  }
+  moonbit_ts_sexp_writer_push_range(self, buffer, node);
+  moonbit_ts_sexp_writer_push_level(self, indent + 1, true);
+}
+
+// Write at least `chunk_size` bytes of the S-expression, stopping at a node
+// boundary. An empty chunk means the whole subtree has been written.
+MOONBIT_FFI_EXPORT
+moonbit_bytes_t
+moonbit_ts_sexp_writer_next(MoonBitTSSexpWriter *self, uint32_t chunk_size) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSBuffer buffer = {0};
+  TSTreeCursor *cursor = &self->cursor;
+  while (!self->done && buffer.length < chunk_size) {
+    if (!self->started) {
+      self->started = true;
+      moonbit_ts_sexp_writer_write_node(self, &buffer);
+      continue;
+    }
+    if (ts_tree_cursor_goto_first_child(cursor)) {
+      moonbit_ts_sexp_writer_write_node(self, &buffer);
+      continue;
+    }
+    for (;;) {
+      if (self->levels[--self->depth].open) {
+        moonbit_ts_buffer_push_byte(&buffer, ')');
+      }
+      if (self->depth == 0) {
+        self->done = true;
+        break;
+      }
+      if (ts_tree_cursor_goto_next_sibling(cursor)) {
+        moonbit_ts_sexp_writer_write_node(self, &buffer);
+        break;
+      }
+      ts_tree_cursor_goto_parent(cursor);
+    }
+  }
+  return moonbit_ts_buffer_to_bytes(&buffer);
+}
+
+static inline void
+moonbit_ts_buffer_push_uint(MoonBitTSBuffer *self, uint32_t value) {
+  char digits[10];
+  int length = 0;
+  do {
+    digits[length++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  moonbit_ts_buffer_reserve(self, (size_t)length);
+  while (length > 0) {
+    self->data[self->length++] = (uint8_t)digits[--length];
+  }
+}
+
+static inline void
+moonbit_ts_buffer_push_json_string(MoonBitTSBuffer *self, const char *string) {
+  static const char hex[] = "0123456789abcdef";
+  moonbit_ts_buffer_push_byte(self, '"');
+  for (const uint8_t *byte = (const uint8_t *)string; *byte; byte++) {
+    switch (*byte) {
+    case '"':
+      moonbit_ts_buffer_push_string(self, "\\\"");
+      break;
+    case '\\':
+      moonbit_ts_buffer_push_string(self, "\\\\");
+      break;
+    case '\n':
+      moonbit_ts_buffer_push_string(self, "\\n");
+      break;
+    case '\r':
+      moonbit_ts_buffer_push_string(self, "\\r");
+      break;
+    case '\t':
+      moonbit_ts_buffer_push_string(self, "\\t");
+      break;
+    default:
+      if (*byte < 0x20) {
+        moonbit_ts_buffer_push_string(self, "\\u00");
+        moonbit_ts_buffer_push_byte(self, (uint8_t)hex[*byte >> 4]);
+        moonbit_ts_buffer_push_byte(self, (uint8_t)hex[*byte & 0xf]);
+      } else {
+        moonbit_ts_buffer_push_byte(self, *byte);
+      }
+    }
+  }
+  moonbit_ts_buffer_push_byte(self, '"');
+}
+
+static inline void
+moonbit_ts_buffer_push_json_point(MoonBitTSBuffer *self, TSPoint point) {
+  moonbit_ts_buffer_push_string(self, "{\"row\":");
+  moonbit_ts_buffer_push_uint(self, point.row);
+  moonbit_ts_buffer_push_string(self, ",\"column\":");
+  moonbit_ts_buffer_push_uint(self, point.column);
+  moonbit_ts_buffer_push_byte(self, '}');
+}
+
+// One level of the JSON walk: whether the node was written, leaving its
+// children array open, and whether its children are walked at all.
+typedef struct MoonBitTSJsonLevel {
+  bool open;
+  bool descend;
+} MoonBitTSJsonLevel;
+
+// Writes a subtree as nested JSON objects in chunks, like
+// `MoonBitTSSexpWriter`. `counts` holds the number of children written so far
+// into each open children array, to place the commas.
+typedef struct MoonBitTSJsonWriter {
+  TSTreeCursor cursor;
+  bool named_only;
+  int32_t max_depth;
+  MoonBitTSJsonLevel *levels;
+  uint32_t depth;
+  uint32_t capacity;
+  uint32_t *counts;
+  uint32_t open_count;
+  bool started;
+  bool done;
+} MoonBitTSJsonWriter;
+
+static inline void
+moonbit_ts_json_writer_delete(void *object) {
+  MoonBitTSJsonWriter *self = (MoonBitTSJsonWriter *)object;
+  ts_tree_cursor_delete(&self->cursor);
+  free(self->levels);
+  free(self->counts);
+}
+
+MOONBIT_FFI_EXPORT
+MoonBitTSJsonWriter *
+moonbit_ts_json_writer_new(
+  MoonBitTSNode *node,
+  MoonBitTSTree *tree,
+  int32_t named_only,
+  int32_t max_depth
+) {
+  MOONBIT_TS_STATS_CALL();
+  moonbit_ts_ignore(tree);
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSJsonWriter *self =
+    (MoonBitTSJsonWriter *)moonbit_make_external_object(
+      moonbit_ts_json_writer_delete, sizeof(MoonBitTSJsonWriter)
+    );
+  self->cursor = ts_tree_cursor_new(node->node);
+  self->named_only = named_only;
+  self->max_depth = max_depth;
+  self->levels = NULL;
+  self->depth = 0;
+  self->capacity = 0;
+  self->counts = NULL;
+  self->open_count = 0;
+  self->started = false;
+  self->done = false;
+  return self;
+}
+
+// Push a walk level. Open levels never outnumber walk levels, so `counts`
+// shares the capacity of `levels`.
+static inline void
+moonbit_ts_json_writer_push_level(
+  MoonBitTSJsonWriter *self,
+  bool open,
+  bool descend
+) {
+  if (self->depth == self->capacity) {
+    self->capacity = self->capacity ? self->capacity * 2 : 32;
+    MOONBIT_TS_STATS_ALLOCATION();
+    self->levels = (MoonBitTSJsonLevel *)realloc(
+      self->levels, self->capacity * sizeof(MoonBitTSJsonLevel)
+    );
+    MOONBIT_TS_STATS_ALLOCATION();
+    self->counts =
+      (uint32_t *)realloc(self->counts, self->capacity * sizeof(uint32_t));
+  }
+  self->levels[self->depth++] = (MoonBitTSJsonLevel){
+    .open = open, .descend = descend
+  };
+  if (open) {
+    self->counts[self->open_count++] = 0;
+  }
+}
+
+static inline void
+moonbit_ts_json_writer_write_node(
+  MoonBitTSJsonWriter *self,
+  MoonBitTSBuffer *buffer
+) {
+  TSNode node = ts_tree_cursor_current_node(&self->cursor);
+  bool is_root = self->depth == 0;
+  bool is_named = ts_node_is_named(node);
+  if (!is_root) {
+    if (self->max_depth >= 0 && self->open_count > (uint32_t)self->max_depth) {
+      moonbit_ts_json_writer_push_level(self, false, false);
+      return;
+    }
+    if (self->named_only && !is_named) {
+      moonbit_ts_json_writer_push_level(self, false, true);
+      return;
+    }
+    if (self->counts[self->open_count - 1]++ > 0) {
+      moonbit_ts_buffer_push_byte(buffer, ',');
+    }
+  }
+  moonbit_ts_buffer_push_string(buffer, "{\"type\":");
+  moonbit_ts_buffer_push_json_string(buffer, ts_node_type(node));
+  moonbit_ts_buffer_push_string(
+    buffer, is_named ? ",\"named\":true" : ",\"named\":false"
+  );
+  const char *field_name =
+    is_root ? NULL : ts_tree_cursor_current_field_name(&self->cursor);
+  if (field_name) {
+    moonbit_ts_buffer_push_string(buffer, ",\"field\":");
+    moonbit_ts_buffer_push_json_string(buffer, field_name);
+  }
+  moonbit_ts_buffer_push_string(buffer, ",\"range\":{\"start_byte\":");
+  moonbit_ts_buffer_push_uint(buffer, ts_node_start_byte(node));
+  moonbit_ts_buffer_push_string(buffer, ",\"end_byte\":");
+  moonbit_ts_buffer_push_uint(buffer, ts_node_end_byte(node));
+  moonbit_ts_buffer_push_string(buffer, ",\"start\":");
+  moonbit_ts_buffer_push_json_point(buffer, ts_node_start_point(node));
+  moonbit_ts_buffer_push_string(buffer, ",\"end\":");
+  moonbit_ts_buffer_push_json_point(buffer, ts_node_end_point(node));
+  moonbit_ts_buffer_push_string(buffer, "},\"children\":[");
+  moonbit_ts_json_writer_push_level(self, true, true);
+}
+
+// Write at least `chunk_size` bytes of JSON, stopping at a node boundary. An
+// empty chunk means the whole subtree has been written.
+MOONBIT_FFI_EXPORT
+moonbit_bytes_t
+moonbit_ts_json_writer_next(MoonBitTSJsonWriter *self, uint32_t chunk_size) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSBuffer buffer = {0};
+  TSTreeCursor *cursor = &self->cursor;
+  while (!self->done && buffer.length < chunk_size) {
+    if (!self->started) {
+      self->started = true;
+      moonbit_ts_json_writer_write_node(self, &buffer);
+      continue;
+    }
+    if (self->levels[self->depth - 1].descend &&
+        ts_tree_cursor_goto_first_child(cursor)) {
+      moonbit_ts_json_writer_write_node(self, &buffer);
+      continue;
+    }
+    for (;;) {
+      if (self->levels[--self->depth].open) {
+        self->open_count--;
+        moonbit_ts_buffer_push_string(&buffer, "]}");
+      }
+      if (self->depth == 0) {
+        self->done = true;
+        break;
+      }
+      if (ts_tree_cursor_goto_next_sibling(cursor)) {
+        moonbit_ts_json_writer_write_node(self, &buffer);
+        break;
+      }
+      ts_tree_cursor_goto_parent(cursor);
+    }
+  }
+  return moonbit_ts_buffer_to_bytes(&buffer);
+}
+
+// Build the pre-order node table of the tree if it is not built yet.
+static inline MoonBitTSTreeIndex *
+moonbit_ts_tree_index(MoonBitTSTree *tree) {
+  if (tree->index) {
+    return tree->index;
+  }
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSTreeIndex *index =
+    (MoonBitTSTreeIndex *)calloc(1, sizeof(MoonBitTSTreeIndex));
+  TSNode root = ts_tree_root_node(tree->tree);
+  uint32_t capacity = ts_node_descendant_count(root);
+  MOONBIT_TS_STATS_ALLOCATION();
+  index->nodes = (TSNode *)malloc(capacity * sizeof(TSNode));
+  MOONBIT_TS_STATS_ALLOCATION();
+  index->parents = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  MOONBIT_TS_STATS_ALLOCATION();
+  index->subtree_ends = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+  TSTreeCursor cursor = ts_tree_cursor_new(root);
+  uint32_t parent = UINT32_MAX;
+  bool done = false;
+  while (!done && index->node_count < capacity) {
+    uint32_t position = index->node_count++;
+    index->nodes[position] = ts_tree_cursor_current_node(&cursor);
+    index->parents[position] = parent;
+    if (ts_tree_cursor_goto_first_child(&cursor)) {
+      parent = position;
+      continue;
+    }
+    index->subtree_ends[position] = position + 1;
+    while (!ts_tree_cursor_goto_next_sibling(&cursor)) {
+      if (!ts_tree_cursor_goto_parent(&cursor)) {
+        done = true;
+        break;
+      }
+      index->subtree_ends[parent] = index->node_count;
+      parent = index->parents[parent];
+    }
+  }
+  for (; parent != UINT32_MAX; parent = index->parents[parent]) {
+    index->subtree_ends[parent] = index->node_count;
+  }
+  ts_tree_cursor_delete(&cursor);
+  tree->index = index;
+  return index;
 }
 
-MOONBIT_FFI_EXPORT
-MoonBitTSNode *
-moonbit_ts_node_descendant_for_byte_range(
-  MoonBitTSNode *self,
-  MoonBitTSTree *tree,
-  uint32_t start,
-  uint32_t end
-) {
-  moonbit_ts_ignore(tree);
-  TSNode node = ts_node_descendant_for_byte_range(self->node, start, end);
-  return moonbit_ts_node_new(node);
+// Symbols index the buckets of the symbol table directly, except for the
+// builtin error symbol, which gets the extra last bucket.
+static inline uint32_t
+moonbit_ts_tree_index_bucket(MoonBitTSTreeIndex *index, TSSymbol symbol) {
+  if (symbol < index->symbol_count) {
+    return symbol;
+  }
+  return symbol == (TSSymbol)-1 ? index->symbol_count : UINT32_MAX;
 }
 
-MOONBIT_FFI_EXPORT
-MoonBitTSNode *
-moonbit_ts_node_descendant_for_point_range(
-  MoonBitTSNode *self,
-  MoonBitTSTree *tree,
-  TSPoint *start,
-  TSPoint *end
-) {
-  moonbit_ts_ignore(tree);
-  TSNode node = ts_node_descendant_for_point_range(self->node, *start, *end);
-  return moonbit_ts_node_new(node);
+// Group the node table by symbol with a counting sort. Each group stays in
+// pre-order, which is also the order of start bytes.
+static inline MoonBitTSTreeIndex *
+moonbit_ts_tree_symbol_index(MoonBitTSTree *tree) {
+  MoonBitTSTreeIndex *index = moonbit_ts_tree_index(tree);
+  if (index->symbol_offsets) {
+    return index;
+  }
+  index->symbol_count = ts_language_symbol_count(ts_tree_language(tree->tree));
+  uint32_t bucket_count = index->symbol_count + 1;
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *offsets = (uint32_t *)calloc(bucket_count + 1, sizeof(uint32_t));
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *symbol_nodes =
+    (uint32_t *)malloc((index->node_count + 1) * sizeof(uint32_t));
+  for (uint32_t i = 0; i < index->node_count; i++) {
+    TSSymbol symbol = ts_node_symbol(index->nodes[i]);
+    uint32_t bucket = moonbit_ts_tree_index_bucket(index, symbol);
+    if (bucket != UINT32_MAX) {
+      offsets[bucket + 1]++;
+    }
+  }
+  for (uint32_t bucket = 0; bucket < bucket_count; bucket++) {
+    offsets[bucket + 1] += offsets[bucket];
+  }
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *cursors = (uint32_t *)malloc(bucket_count * sizeof(uint32_t));
+  memcpy(cursors, offsets, bucket_count * sizeof(uint32_t));
+  for (uint32_t i = 0; i < index->node_count; i++) {
+    TSSymbol symbol = ts_node_symbol(index->nodes[i]);
+    uint32_t bucket = moonbit_ts_tree_index_bucket(index, symbol);
+    if (bucket != UINT32_MAX) {
+      symbol_nodes[cursors[bucket]++] = i;
+    }
+  }
+  free(cursors);
+  index->symbol_offsets = offsets;
+  index->symbol_nodes = symbol_nodes;
+  return index;
 }
 
-MOONBIT_FFI_EXPORT
-MoonBitTSNode *
-moonbit_ts_node_named_descendant_for_byte_range(
-  MoonBitTSNode *self,
-  MoonBitTSTree *tree,
-  uint32_t start,
-  uint32_t end
+// Find the first slot in `[first, last)` of the symbol table whose node starts
+// at or after `byte`.
+static inline uint32_t
+moonbit_ts_tree_symbol_index_lower_bound(
+  MoonBitTSTreeIndex *index,
+  uint32_t first,
+  uint32_t last,
+  uint32_t byte
 ) {
-  moonbit_ts_ignore(tree);
-  TSNode node = ts_node_named_descendant_for_byte_range(self->node, start, end);
-  return moonbit_ts_node_new(node);
+  while (first < last) {
+    uint32_t middle = first + (last - first) / 2;
+    TSNode node = index->nodes[index->symbol_nodes[middle]];
+    if (ts_node_start_byte(node) < byte) {
+      first = middle + 1;
+    } else {
+      last = middle;
+    }
+  }
+  return first;
 }
 
-MOONBIT_FFI_EXPORT
-MoonBitTSNode *
-moonbit_ts_node_named_descendant_for_point_range(
-  MoonBitTSNode *self,
-  MoonBitTSTree *tree,
-  TSPoint *start,
-  TSPoint *end
+// Find the slots `[range[0], range[1])` of the symbol table holding the nodes
+// of `symbol` that start within `[start_byte, end_byte)`.
+static inline void
+moonbit_ts_tree_symbol_index_range(
+  MoonBitTSTreeIndex *index,
+  TSSymbol symbol,
+  uint32_t start_byte,
+  uint32_t end_byte,
+  uint32_t range[2]
 ) {
-  moonbit_ts_ignore(tree);
-  TSNode node =
-    ts_node_named_descendant_for_point_range(self->node, *start, *end);
-  return moonbit_ts_node_new(node);
+  range[0] = range[1] = 0;
+  uint32_t bucket = moonbit_ts_tree_index_bucket(index, symbol);
+  if (bucket == UINT32_MAX) {
+    return;
+  }
+  uint32_t first = index->symbol_offsets[bucket];
+  uint32_t last = index->symbol_offsets[bucket + 1];
+  if (start_byte > 0) {
+    first = moonbit_ts_tree_symbol_index_lower_bound(
+      index, first, last, start_byte
+    );
+  }
+  if (end_byte != UINT32_MAX) {
+    last =
+      moonbit_ts_tree_symbol_index_lower_bound(index, first, last, end_byte);
+  }
+  range[0] = first;
+  range[1] = last;
 }
 
+// Count the nodes of `symbol` that start within `[start_byte, end_byte)`.
 MOONBIT_FFI_EXPORT
-void
-moonbit_ts_node_edit(
-  MoonBitTSNode *self,
+uint32_t
+moonbit_ts_node_index_count(
   MoonBitTSTree *tree,
-  TSInputEdit *edit
+  TSSymbol symbol,
+  uint32_t start_byte,
+  uint32_t end_byte
 ) {
-  moonbit_ts_ignore(tree);
-  ts_node_edit(&self->node, edit);
+  MOONBIT_TS_STATS_CALL();
+  uint32_t range[2];
+  moonbit_ts_tree_symbol_index_range(
+    moonbit_ts_tree_symbol_index(tree), symbol, start_byte, end_byte, range
+  );
+  return range[1] - range[0];
 }
 
+// Get the nodes of `symbol` that start within `[start_byte, end_byte)`, in the
+// order of their start bytes.
 MOONBIT_FFI_EXPORT
-int32_t
-moonbit_ts_node_eq(
-  MoonBitTSNode *self,
-  MoonBitTSTree *self_tree,
-  MoonBitTSNode *other,
-  MoonBitTSTree *other_tree
+MoonBitTSNode **
+moonbit_ts_node_index_nodes(
+  MoonBitTSTree *tree,
+  TSSymbol symbol,
+  uint32_t start_byte,
+  uint32_t end_byte
 ) {
-  moonbit_ts_ignore(self_tree);
-  moonbit_ts_ignore(other_tree);
-  return ts_node_eq(self->node, other->node);
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSTreeIndex *index = moonbit_ts_tree_symbol_index(tree);
+  uint32_t range[2];
+  moonbit_ts_tree_symbol_index_range(
+    index, symbol, start_byte, end_byte, range
+  );
+  uint32_t count = range[1] - range[0];
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSNode **nodes =
+    (MoonBitTSNode **)moonbit_make_ref_array(count, NULL);
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t position = index->symbol_nodes[range[0] + i];
+    nodes[i] = moonbit_ts_node_new(index->nodes[position]);
+  }
+  return nodes;
 }
 
-MOONBIT_FFI_EXPORT
-uint64_t
-moonbit_ts_node_id_as_uint64(MoonBitTSNode *self, MoonBitTSTree *self_tree) {
-  moonbit_ts_ignore(self_tree);
-  return (uintptr_t)self->node.id;
+// Build the tables used for position lookups: the end of every node and the
+// children of every node, grouped by parent.
+static inline MoonBitTSTreeIndex *
+moonbit_ts_tree_interval_index(MoonBitTSTree *tree) {
+  MoonBitTSTreeIndex *index = moonbit_ts_tree_index(tree);
+  if (index->child_offsets) {
+    return index;
+  }
+  uint32_t count = index->node_count;
+  MOONBIT_TS_STATS_ALLOCATION();
+  index->end_bytes = (uint32_t *)malloc((count + 1) * sizeof(uint32_t));
+  MOONBIT_TS_STATS_ALLOCATION();
+  index->end_points = (TSPoint *)malloc((count + 1) * sizeof(TSPoint));
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *offsets = (uint32_t *)calloc(count + 1, sizeof(uint32_t));
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *children = (uint32_t *)malloc((count + 1) * sizeof(uint32_t));
+  for (uint32_t i = 0; i < count; i++) {
+    index->end_bytes[i] = ts_node_end_byte(index->nodes[i]);
+    index->end_points[i] = ts_node_end_point(index->nodes[i]);
+    if (index->parents[i] != UINT32_MAX) {
+      offsets[index->parents[i] + 1]++;
+    }
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    offsets[i + 1] += offsets[i];
+  }
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *cursors = (uint32_t *)malloc((count + 1) * sizeof(uint32_t));
+  memcpy(cursors, offsets, (count + 1) * sizeof(uint32_t));
+  for (uint32_t i = 0; i < count; i++) {
+    if (index->parents[i] != UINT32_MAX) {
+      children[cursors[index->parents[i]]++] = i;
+    }
+  }
+  free(cursors);
+  index->child_offsets = offsets;
+  index->children = children;
+  return index;
 }
 
-typedef struct MoonBitTSTreeCursor {
-  TSTreeCursor cursor;
-} MoonBitTSTreeCursor;
-
-static inline void
-moonbit_ts_tree_cursor_delete(void *object) {
-  MoonBitTSTreeCursor *cursor = (MoonBitTSTreeCursor *)object;
-  ts_tree_cursor_delete(&cursor->cursor);
+// Positions are compared as bytes, or as points packed into one integer.
+static inline uint64_t
+moonbit_ts_point_key(TSPoint point) {
+  return ((uint64_t)point.row << 32) | point.column;
 }
 
-MOONBIT_FFI_EXPORT
-MoonBitTSTreeCursor *
-moonbit_ts_tree_cursor_new(MoonBitTSNode *node) {
-  MoonBitTSTreeCursor *cursor =
-    (MoonBitTSTreeCursor *)moonbit_make_external_object(
-      moonbit_ts_tree_cursor_delete, sizeof(MoonBitTSTreeCursor)
-    );
-  cursor->cursor = ts_tree_cursor_new(node->node);
-  return cursor;
+static inline uint64_t
+moonbit_ts_tree_index_start(
+  MoonBitTSTreeIndex *index,
+  uint32_t position,
+  int32_t points
+) {
+  TSNode node = index->nodes[position];
+  return points ? moonbit_ts_point_key(ts_node_start_point(node))
+                : ts_node_start_byte(node);
 }
 
-MOONBIT_FFI_EXPORT
-void
-moonbit_ts_tree_cursor_reset(MoonBitTSTreeCursor *self, MoonBitTSNode *node) {
-  ts_tree_cursor_reset(&self->cursor, node->node);
+static inline uint64_t
+moonbit_ts_tree_index_end(
+  MoonBitTSTreeIndex *index,
+  uint32_t position,
+  int32_t points
+) {
+  return points ? moonbit_ts_point_key(index->end_points[position])
+                : index->end_bytes[position];
 }
 
-MOONBIT_FFI_EXPORT
-void
-moonbit_ts_tree_cursor_reset_to(
-  MoonBitTSTreeCursor *dst,
-  MoonBitTSTreeCursor *src
+// The same descent as `ts_node_descendant_for_byte_range` and its variants,
+// except that the child to descend into is found by binary search on the ends
+// of the children instead of by a linear scan.
+static inline uint32_t
+moonbit_ts_tree_index_descendant_for_range(
+  MoonBitTSTreeIndex *index,
+  uint64_t range_start,
+  uint64_t range_end,
+  int32_t include_anonymous,
+  int32_t points
 ) {
-  ts_tree_cursor_reset_to(&dst->cursor, &src->cursor);
+  if (range_start > range_end) {
+    return UINT32_MAX;
+  }
+  uint32_t node = 0;
+  uint32_t last_visible_node = 0;
+  for (;;) {
+    uint32_t first = index->child_offsets[node];
+    uint32_t last = index->child_offsets[node + 1];
+    while (first < last) {
+      uint32_t middle = first + (last - first) / 2;
+      uint64_t end = moonbit_ts_tree_index_end(
+        index, index->children[middle], points
+      );
+      if (end < range_end) {
+        first = middle + 1;
+      } else {
+        last = middle;
+      }
+    }
+    uint32_t next = UINT32_MAX;
+    for (uint32_t i = first; i < index->child_offsets[node + 1]; i++) {
+      uint32_t child = index->children[i];
+      uint64_t start = moonbit_ts_tree_index_start(index, child, points);
+      uint64_t end = moonbit_ts_tree_index_end(index, child, points);
+      bool is_empty = start == end;
+      if (is_empty ? end < range_start : end <= range_start) {
+        continue;
+      }
+      if (range_start < start) {
+        break;
+      }
+      next = child;
+      break;
+    }
+    if (next == UINT32_MAX) {
+      break;
+    }
+    node = next;
+    if (include_anonymous || ts_node_is_named(index->nodes[node])) {
+      last_visible_node = node;
+    }
+  }
+  return last_visible_node;
+}
+
+// Collect the nodes that overlap `[range_start, range_end)`, in pre-order.
+// Those starting before the range all contain its start, so they are
+// ancestors of the last node starting before it; the others start within the
+// range and form a contiguous run of positions.
+static inline MoonBitTSNode **
+moonbit_ts_tree_index_overlapping(
+  MoonBitTSTreeIndex *index,
+  uint64_t range_start,
+  uint64_t range_end,
+  int32_t points
+) {
+  uint32_t count = index->node_count;
+  uint32_t bounds[2] = {0, 0};
+  uint64_t keys[2] = {range_start, range_end};
+  for (int i = 0; i < 2; i++) {
+    uint32_t first = 0;
+    uint32_t last = count;
+    while (first < last) {
+      uint32_t middle = first + (last - first) / 2;
+      if (moonbit_ts_tree_index_start(index, middle, points) < keys[i]) {
+        first = middle + 1;
+      } else {
+        last = middle;
+      }
+    }
+    bounds[i] = first;
+  }
+  if (bounds[1] < bounds[0]) {
+    bounds[1] = bounds[0];
+  }
+  uint32_t ancestor_count = 0;
+  for (uint32_t node = bounds[0] > 0 ? bounds[0] - 1 : UINT32_MAX;
+       node != UINT32_MAX; node = index->parents[node]) {
+    if (moonbit_ts_tree_index_end(index, node, points) > range_start) {
+      ancestor_count++;
+    }
+  }
+  uint32_t capacity = ancestor_count + (bounds[1] - bounds[0]);
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *result = (uint32_t *)malloc((capacity + 1) * sizeof(uint32_t));
+  uint32_t length = ancestor_count;
+  for (uint32_t node = bounds[0] > 0 ? bounds[0] - 1 : UINT32_MAX;
+       node != UINT32_MAX; node = index->parents[node]) {
+    if (moonbit_ts_tree_index_end(index, node, points) > range_start) {
+      result[--length] = node;
+    }
+  }
+  length = ancestor_count;
+  for (uint32_t node = bounds[0]; node < bounds[1]; node++) {
+    if (moonbit_ts_tree_index_end(index, node, points) > range_start) {
+      result[length++] = node;
+    }
+  }
+  MOONBIT_TS_STATS_ALLOCATION();
+  MoonBitTSNode **nodes =
+    (MoonBitTSNode **)moonbit_make_ref_array(length, NULL);
+  for (uint32_t i = 0; i < length; i++) {
+    nodes[i] = moonbit_ts_node_new(index->nodes[result[i]]);
+  }
+  free(result);
+  return nodes;
 }
 
 MOONBIT_FFI_EXPORT
 MoonBitTSNode *
-moonbit_ts_tree_cursor_current_node(MoonBitTSTreeCursor *self) {
-  TSNode node = ts_tree_cursor_current_node(&self->cursor);
+moonbit_ts_interval_index_descendant_for_byte_range(
+  MoonBitTSTree *tree,
+  uint32_t start_byte,
+  uint32_t end_byte,
+  int32_t named
+) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSTreeIndex *index = moonbit_ts_tree_interval_index(tree);
+  uint32_t position = moonbit_ts_tree_index_descendant_for_range(
+    index, start_byte, end_byte, !named, false
+  );
+  TSNode node = {0};
+  if (position != UINT32_MAX) {
+    node = index->nodes[position];
+  }
   return moonbit_ts_node_new(node);
 }
 
 MOONBIT_FFI_EXPORT
-const char *
-moonbit_ts_tree_cursor_current_field_name(MoonBitTSTreeCursor *self) {
-  return ts_tree_cursor_current_field_name(&self->cursor);
+MoonBitTSNode *
+moonbit_ts_interval_index_descendant_for_point_range(
+  MoonBitTSTree *tree,
+  TSPoint *start,
+  TSPoint *end,
+  int32_t named
+) {
+  MOONBIT_TS_STATS_CALL();
+  MoonBitTSTreeIndex *index = moonbit_ts_tree_interval_index(tree);
+  uint32_t position = moonbit_ts_tree_index_descendant_for_range(
+    index, moonbit_ts_point_key(*start), moonbit_ts_point_key(*end), !named,
+    true
+  );
+  TSNode node = {0};
+  if (position != UINT32_MAX) {
+    node = index->nodes[position];
+  }
+  return moonbit_ts_node_new(node);
 }
 
 MOONBIT_FFI_EXPORT
-TSFieldId
-moonbit_ts_tree_cursor_current_field_id(MoonBitTSTreeCursor *self) {
-  return ts_tree_cursor_current_field_id(&self->cursor);
+MoonBitTSNode **
+moonbit_ts_interval_index_overlapping_byte_range(
+  MoonBitTSTree *tree,
+  uint32_t start_byte,
+  uint32_t end_byte
+) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_tree_index_overlapping(
+    moonbit_ts_tree_interval_index(tree), start_byte, end_byte, false
+  );
 }
 
 MOONBIT_FFI_EXPORT
-int32_t
-moonbit_ts_tree_cursor_goto_parent(MoonBitTSTreeCursor *self) {
-  return ts_tree_cursor_goto_parent(&self->cursor);
+MoonBitTSNode **
+moonbit_ts_interval_index_overlapping_point_range(
+  MoonBitTSTree *tree,
+  TSPoint *start,
+  TSPoint *end
+) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_tree_index_overlapping(
+    moonbit_ts_tree_interval_index(tree), moonbit_ts_point_key(*start),
+    moonbit_ts_point_key(*end), true
+  );
 }
 
+// Get the node at a pre-order position of the tree.
 MOONBIT_FFI_EXPORT
-int32_t
-moonbit_ts_tree_cursor_goto_next_sibling(MoonBitTSTreeCursor *self) {
-  return ts_tree_cursor_goto_next_sibling(&self->cursor);
+MoonBitTSNode *
+moonbit_ts_tree_index_node(MoonBitTSTree *tree, uint32_t position) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_node_new(moonbit_ts_tree_index(tree)->nodes[position]);
 }
 
-MOONBIT_FFI_EXPORT
-int32_t
-moonbit_ts_tree_cursor_goto_previous_sibling(MoonBitTSTreeCursor *self) {
-  return ts_tree_cursor_goto_previous_sibling(&self->cursor);
+static inline uint32_t
+moonbit_ts_tree_index_hash_id(const void *id) {
+  uint64_t value = (uint64_t)(uintptr_t)id;
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+  return (uint32_t)value;
 }
 
-MOONBIT_FFI_EXPORT
-int32_t
-moonbit_ts_tree_cursor_goto_first_child(MoonBitTSTreeCursor *self) {
-  return ts_tree_cursor_goto_first_child(&self->cursor);
+// Build the tables used for parent lookups: the depth of every node and the
+// table from node ids to positions.
+static inline MoonBitTSTreeIndex *
+moonbit_ts_tree_parent_index(MoonBitTSTree *tree) {
+  MoonBitTSTreeIndex *index = moonbit_ts_tree_index(tree);
+  if (index->id_slots) {
+    return index;
+  }
+  uint32_t count = index->node_count;
+  MOONBIT_TS_STATS_ALLOCATION();
+  index->depths = (uint32_t *)malloc((count + 1) * sizeof(uint32_t));
+  uint32_t slot_count = 16;
+  while (slot_count < count * 2) {
+    slot_count *= 2;
+  }
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *slots = (uint32_t *)calloc(slot_count, sizeof(uint32_t));
+  uint32_t mask = slot_count - 1;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t parent = index->parents[i];
+    index->depths[i] = parent == UINT32_MAX ? 0 : index->depths[parent] + 1;
+    uint32_t slot = moonbit_ts_tree_index_hash_id(index->nodes[i].id) & mask;
+    while (slots[slot]) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = i + 1;
+  }
+  index->id_slots = slots;
+  index->id_mask = mask;
+  return index;
 }
 
-MOONBIT_FFI_EXPORT
-int32_t
-moonbit_ts_tree_cursor_goto_last_child(MoonBitTSTreeCursor *self) {
-  return ts_tree_cursor_goto_last_child(&self->cursor);
+// Find the position of a node of the tree, or `UINT32_MAX` if the node belongs
+// to another tree.
+static inline uint32_t
+moonbit_ts_tree_index_position(MoonBitTSTreeIndex *index, TSNode node) {
+  uint32_t slot = moonbit_ts_tree_index_hash_id(node.id) & index->id_mask;
+  while (index->id_slots[slot]) {
+    uint32_t position = index->id_slots[slot] - 1;
+    TSNode candidate = index->nodes[position];
+    if (candidate.id == node.id && candidate.tree == node.tree) {
+      return position;
+    }
+    slot = (slot + 1) & index->id_mask;
+  }
+  return UINT32_MAX;
 }
 
 MOONBIT_FFI_EXPORT
-void
-moonbit_ts_tree_cursor_goto_descendant(
-  MoonBitTSTreeCursor *self,
-  uint32_t goal_descendant_index
-) {
-  ts_tree_cursor_goto_descendant(&self->cursor, goal_descendant_index);
+uint32_t
+moonbit_ts_parent_index_position(MoonBitTSTree *tree, MoonBitTSNode *node) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_tree_index_position(
+    moonbit_ts_tree_parent_index(tree), node->node
+  );
 }
 
 MOONBIT_FFI_EXPORT
 uint32_t
-moonbit_ts_tree_cursor_current_descendant_index(MoonBitTSTreeCursor *self) {
-  return ts_tree_cursor_current_descendant_index(&self->cursor);
+moonbit_ts_parent_index_parent(MoonBitTSTree *tree, uint32_t position) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_tree_parent_index(tree)->parents[position];
 }
 
 MOONBIT_FFI_EXPORT
 uint32_t
-moonbit_ts_tree_cursor_current_depth(MoonBitTSTreeCursor *self) {
-  return ts_tree_cursor_current_depth(&self->cursor);
+moonbit_ts_parent_index_depth(MoonBitTSTree *tree, uint32_t position) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_tree_parent_index(tree)->depths[position];
 }
 
 MOONBIT_FFI_EXPORT
-int64_t
-moonbit_ts_tree_cursor_goto_first_child_for_byte(
-  MoonBitTSTreeCursor *self,
-  uint32_t goal_byte
-) {
-  return ts_tree_cursor_goto_first_child_for_byte(&self->cursor, goal_byte);
+uint32_t
+moonbit_ts_tree_index_count(MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
+  return moonbit_ts_tree_index(tree)->node_count;
 }
 
-MOONBIT_FFI_EXPORT
-int64_t
-moonbit_ts_tree_cursor_goto_first_child_for_point(
-  MoonBitTSTreeCursor *self,
-  TSPoint *goal_point
-) {
-  return ts_tree_cursor_goto_first_child_for_point(&self->cursor, *goal_point);
+// Find the pre-order index of a node that is not in the node table by moving
+// a cursor down to it, one child_with_descendant step per level.
+static inline uint32_t
+moonbit_ts_tree_descendant_index(TSTree *tree, TSNode node) {
+  TSNode current = ts_tree_root_node(tree);
+  TSTreeCursor cursor = ts_tree_cursor_new(current);
+  uint32_t position = UINT32_MAX;
+  while (true) {
+    if (current.id == node.id) {
+      position = ts_tree_cursor_current_descendant_index(&cursor);
+      break;
+    }
+    TSNode child = ts_node_child_with_descendant(current, node);
+    if (ts_node_is_null(child) || !ts_tree_cursor_goto_first_child(&cursor)) {
+      break;
+    }
+    current = ts_tree_cursor_current_node(&cursor);
+    while (current.id != child.id &&
+           ts_tree_cursor_goto_next_sibling(&cursor)) {
+      current = ts_tree_cursor_current_node(&cursor);
+    }
+    if (current.id != child.id) {
+      break;
+    }
+  }
+  ts_tree_cursor_delete(&cursor);
+  return position;
 }
 
 MOONBIT_FFI_EXPORT
-MoonBitTSTreeCursor *
-moonbit_ts_tree_cursor_copy(MoonBitTSTreeCursor *self) {
-  MoonBitTSTreeCursor *copy =
-    (MoonBitTSTreeCursor *)moonbit_make_external_object(
-      moonbit_ts_tree_cursor_delete, sizeof(MoonBitTSTreeCursor)
-    );
-  copy->cursor = ts_tree_cursor_copy(&self->cursor);
-  return copy;
+uint32_t *
+moonbit_ts_node_subtree_range(MoonBitTSNode *node, MoonBitTSTree *tree) {
+  MOONBIT_TS_STATS_CALL();
+  MOONBIT_TS_STATS_ALLOCATION();
+  uint32_t *range = (uint32_t *)moonbit_make_int32_array(2, 0);
+  MoonBitTSTreeIndex *index = moonbit_ts_tree_parent_index(tree);
+  uint32_t position = moonbit_ts_tree_index_position(index, node->node);
+  if (position != UINT32_MAX) {
+    range[0] = position;
+    range[1] = index->subtree_ends[position];
+    return range;
+  }
+  position = moonbit_ts_tree_descendant_index(tree->tree, node->node);
+  if (position != UINT32_MAX) {
+    range[0] = position;
+    range[1] = position + ts_node_descendant_count(node->node);
+  }
+  return range;
 }
 
 typedef struct MoonBitTSQuery {
@@ -1117,7 +4741,9 @@ moonbit_ts_query_new(
   moonbit_bytes_t source,
   uint32_t *error
 ) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t length = Moonbit_array_length(source);
+  MOONBIT_TS_STATS_ALLOCATION();
   MoonBitTSQuery *query = moonbit_make_external_object(
     moonbit_ts_query_delete, sizeof(MoonBitTSQuery)
   );
@@ -1138,6 +4764,7 @@ moonbit_ts_query_new(
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_query_pattern_count(MoonBitTSQuery *self) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t count = ts_query_pattern_count(self->query);
   return count;
 }
@@ -1145,6 +4772,7 @@ moonbit_ts_query_pattern_count(MoonBitTSQuery *self) {
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_query_capture_count(MoonBitTSQuery *self) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t count = ts_query_capture_count(self->query);
   return count;
 }
@@ -1152,6 +4780,7 @@ moonbit_ts_query_capture_count(MoonBitTSQuery *self) {
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_query_string_count(MoonBitTSQuery *self) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t count = ts_query_string_count(self->query);
   return count;
 }
@@ -1162,6 +4791,7 @@ moonbit_ts_query_start_byte_for_pattern(
   MoonBitTSQuery *self,
   uint32_t pattern_index
 ) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t start_byte =
     ts_query_start_byte_for_pattern(self->query, pattern_index);
   return start_byte;
@@ -1173,6 +4803,7 @@ moonbit_ts_query_end_byte_for_pattern(
   MoonBitTSQuery *self,
   uint32_t pattern_index
 ) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t end_byte = ts_query_end_byte_for_pattern(self->query, pattern_index);
   return end_byte;
 }
@@ -1185,9 +4816,11 @@ moonbit_ts_query_predicates_for_pattern(
   MoonBitTSQuery *self,
   uint32_t pattern_index
 ) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t step_count = 0;
   const TSQueryPredicateStep *predicates =
     ts_query_predicates_for_pattern(self->query, pattern_index, &step_count);
+  MOONBIT_TS_STATS_ALLOCATION();
   uint32_t *copy = (uint32_t *)moonbit_make_int32_array(
     moonbit_uint_to_int(step_count * 2), 0
   );
@@ -1204,6 +4837,7 @@ moonbit_ts_query_is_pattern_rooted(
   MoonBitTSQuery *self,
   uint32_t pattern_index
 ) {
+  MOONBIT_TS_STATS_CALL();
   bool result = ts_query_is_pattern_rooted(self->query, pattern_index);
   return result;
 }
@@ -1214,6 +4848,7 @@ moonbit_ts_query_is_pattern_non_local(
   MoonBitTSQuery *self,
   uint32_t pattern_index
 ) {
+  MOONBIT_TS_STATS_CALL();
   bool result = ts_query_is_pattern_non_local(self->query, pattern_index);
   return result;
 }
@@ -1224,6 +4859,7 @@ moonbit_ts_query_is_pattern_guaranteed_at_step(
   MoonBitTSQuery *self,
   uint32_t byte_offset
 ) {
+  MOONBIT_TS_STATS_CALL();
   bool result =
     ts_query_is_pattern_guaranteed_at_step(self->query, byte_offset);
   return result;
@@ -1236,6 +4872,7 @@ moonbit_ts_query_capture_name_for_id(
   uint32_t index,
   uint32_t *length
 ) {
+  MOONBIT_TS_STATS_CALL();
   return ts_query_capture_name_for_id(self->query, index, length);
 }
 
@@ -1248,6 +4885,7 @@ moonbit_ts_query_capture_quantifier_for_id(
   uint32_t pattern_index,
   uint32_t capture_index
 ) {
+  MOONBIT_TS_STATS_CALL();
   TSQuantifier quantifier = ts_query_capture_quantifier_for_id(
     self->query, pattern_index, capture_index
   );
@@ -1257,6 +4895,7 @@ moonbit_ts_query_capture_quantifier_for_id(
 MOONBIT_FFI_EXPORT
 moonbit_bytes_t
 moonbit_ts_query_string_value_for_id(MoonBitTSQuery *self, uint32_t index) {
+  MOONBIT_TS_STATS_CALL();
   // The returned string value is copied into a newly allocated moonbit bytes.
   // When this function is the last usage of the query, the query will be
   // deleted immediately after this function returns. However, this will make
@@ -1268,6 +4907,7 @@ moonbit_ts_query_string_value_for_id(MoonBitTSQuery *self, uint32_t index) {
   if (string_value == NULL) {
     return NULL;
   }
+  MOONBIT_TS_STATS_ALLOCATION();
   moonbit_bytes_t bytes = moonbit_make_bytes_sz(length, 0);
   memcpy(bytes, string_value, length);
   return bytes;
@@ -1276,6 +4916,7 @@ moonbit_ts_query_string_value_for_id(MoonBitTSQuery *self, uint32_t index) {
 MOONBIT_FFI_EXPORT
 void
 moonbit_ts_query_disable_capture(MoonBitTSQuery *self, moonbit_bytes_t name) {
+  MOONBIT_TS_STATS_CALL();
   ts_query_disable_capture(
     self->query, (const char *)name, Moonbit_array_length(name)
   );
@@ -1284,6 +4925,7 @@ moonbit_ts_query_disable_capture(MoonBitTSQuery *self, moonbit_bytes_t name) {
 MOONBIT_FFI_EXPORT
 void
 moonbit_ts_query_disable_pattern(MoonBitTSQuery *self, uint32_t pattern_index) {
+  MOONBIT_TS_STATS_CALL();
   ts_query_disable_pattern(self->query, pattern_index);
 }
 
@@ -1302,6 +4944,8 @@ moonbit_ts_query_cursor_delete(void *object) {
 MOONBIT_FFI_EXPORT
 MoonBitTSQueryCursor *
 moonbit_ts_query_cursor_new(void) {
+  MOONBIT_TS_STATS_CALL();
+  MOONBIT_TS_STATS_ALLOCATION();
   MoonBitTSQueryCursor *cursor = moonbit_make_external_object(
     moonbit_ts_query_cursor_delete, sizeof(MoonBitTSQueryCursor)
   );
@@ -1319,6 +4963,7 @@ moonbit_ts_query_cursor_exec(
   MoonBitTSNode *node,
   MoonBitTSTree *tree
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   ts_query_cursor_exec(self->cursor, query->query, node->node);
   moonbit_ts_trace("self = %p\n", (void *)self);
@@ -1348,6 +4993,7 @@ moonbit_ts_query_cursor_exec_with_options(
   MoonBitTSTree *tree,
   MoonBitTSQueryCursorProgressCallback *callback
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(tree);
   TSQueryCursorOptions options = {
     .payload = callback,
@@ -1361,12 +5007,14 @@ moonbit_ts_query_cursor_exec_with_options(
 MOONBIT_FFI_EXPORT
 int32_t
 moonbit_ts_query_cursor_did_exceed_match_limit(MoonBitTSQueryCursor *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_query_cursor_did_exceed_match_limit(self->cursor);
 }
 
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_query_cursor_match_limit(MoonBitTSQueryCursor *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_query_cursor_match_limit(self->cursor);
 }
 
@@ -1376,6 +5024,7 @@ moonbit_ts_query_cursor_set_match_limit(
   MoonBitTSQueryCursor *self,
   uint32_t limit
 ) {
+  MOONBIT_TS_STATS_CALL();
   ts_query_cursor_set_match_limit(self->cursor, limit);
 }
 
@@ -1386,6 +5035,7 @@ moonbit_ts_query_cursor_set_byte_range(
   uint32_t start_byte,
   uint32_t end_byte
 ) {
+  MOONBIT_TS_STATS_CALL();
   ts_query_cursor_set_byte_range(self->cursor, start_byte, end_byte);
 }
 
@@ -1396,9 +5046,26 @@ moonbit_ts_query_cursor_set_point_range(
   TSPoint *start_point,
   TSPoint *end_point
 ) {
+  MOONBIT_TS_STATS_CALL();
   ts_query_cursor_set_point_range(self->cursor, *start_point, *end_point);
 }
 
+// Restore the limits and ranges of a fresh query cursor, so that a recycled
+// cursor does not carry the settings of its previous user.
+MOONBIT_FFI_EXPORT
+void
+moonbit_ts_query_cursor_reset_options(MoonBitTSQueryCursor *self) {
+  MOONBIT_TS_STATS_CALL();
+  ts_query_cursor_set_match_limit(self->cursor, UINT32_MAX);
+  ts_query_cursor_set_byte_range(self->cursor, 0, UINT32_MAX);
+  ts_query_cursor_set_point_range(
+    self->cursor,
+    (TSPoint){.row = 0, .column = 0},
+    (TSPoint){.row = UINT32_MAX, .column = UINT32_MAX}
+  );
+  ts_query_cursor_set_max_start_depth(self->cursor, UINT32_MAX);
+}
+
 typedef struct MoonBitTSQueryMatch {
   TSQueryMatch match;
 } MoonBitTSQueryMatch;
@@ -1410,10 +5077,12 @@ moonbit_ts_query_cursor_next_match(
   MoonBitTSQuery *query,
   MoonBitTSTree *tree
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(query);
   moonbit_ts_ignore(tree);
   moonbit_ts_trace("self = %p\n", (void *)self);
   moonbit_ts_trace("self->cursor = %p\n", (void *)self->cursor);
+  MOONBIT_TS_STATS_ALLOCATION();
   MoonBitTSQueryMatch *match = (MoonBitTSQueryMatch *)moonbit_make_bytes_sz(
     sizeof(MoonBitTSQueryMatch), 0
   );
@@ -1435,6 +5104,7 @@ moonbit_ts_query_cursor_remove_match(
   MoonBitTSTree *tree,
   uint32_t match_id
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(query);
   moonbit_ts_ignore(tree);
   ts_query_cursor_remove_match(self->cursor, match_id);
@@ -1448,8 +5118,10 @@ moonbit_ts_query_cursor_next_capture(
   MoonBitTSTree *tree,
   uint32_t *match_id
 ) {
+  MOONBIT_TS_STATS_CALL();
   moonbit_ts_ignore(query);
   moonbit_ts_ignore(tree);
+  MOONBIT_TS_STATS_ALLOCATION();
   MoonBitTSQueryMatch *match = (MoonBitTSQueryMatch *)moonbit_make_bytes_sz(
     sizeof(MoonBitTSQueryMatch), 0
   );
@@ -1469,24 +5141,28 @@ moonbit_ts_query_cursor_set_max_start_depth(
   MoonBitTSQueryCursor *self,
   uint32_t max_start_depth
 ) {
+  MOONBIT_TS_STATS_CALL();
   ts_query_cursor_set_max_start_depth(self->cursor, max_start_depth);
 }
 
 MOONBIT_FFI_EXPORT
 uint32_t
 moonbit_ts_query_match_id(MoonBitTSQueryMatch *self) {
+  MOONBIT_TS_STATS_CALL();
   return self->match.id;
 }
 
 MOONBIT_FFI_EXPORT
 uint16_t
 moonbit_ts_query_match_pattern_index(MoonBitTSQueryMatch *self) {
+  MOONBIT_TS_STATS_CALL();
   return self->match.pattern_index;
 }
 
 MOONBIT_FFI_EXPORT
 uint16_t
 moonbit_ts_query_match_capture_count(MoonBitTSQueryMatch *self) {
+  MOONBIT_TS_STATS_CALL();
   return self->match.capture_count;
 }
 
@@ -1496,6 +5172,7 @@ moonbit_ts_query_match_captures_get_node(
   MoonBitTSQueryMatch *self,
   uint32_t index
 ) {
+  MOONBIT_TS_STATS_CALL();
   TSNode node = self->match.captures[index].node;
   moonbit_ts_trace("node.id = %p\n", node.id);
   return moonbit_ts_node_new(node);
@@ -1507,6 +5184,7 @@ moonbit_ts_query_match_captures_get_index(
   MoonBitTSQueryMatch *self,
   uint32_t index
 ) {
+  MOONBIT_TS_STATS_CALL();
   uint32_t i = self->match.captures[index].index;
   return i;
 }
@@ -1524,6 +5202,8 @@ moonbit_ts_lookahead_iterator_delete(void *object) {
 MOONBIT_FFI_EXPORT
 MoonBitTSLookaheadIterator *
 moonbit_ts_lookahead_iterator_new(TSLanguage *language, TSStateId state) {
+  MOONBIT_TS_STATS_CALL();
+  MOONBIT_TS_STATS_ALLOCATION();
   MoonBitTSLookaheadIterator *self =
     (MoonBitTSLookaheadIterator *)moonbit_make_external_object(
       moonbit_ts_lookahead_iterator_delete, sizeof(MoonBitTSLookaheadIterator)
@@ -1538,6 +5218,7 @@ moonbit_ts_lookahead_iterator_reset_state(
   MoonBitTSLookaheadIterator *self,
   TSStateId state
 ) {
+  MOONBIT_TS_STATS_CALL();
   return ts_lookahead_iterator_reset_state(self->iterator, state);
 }
 
@@ -1548,18 +5229,21 @@ moonbit_ts_lookahead_iterator_reset(
   TSLanguage *language,
   TSStateId state
 ) {
+  MOONBIT_TS_STATS_CALL();
   return ts_lookahead_iterator_reset(self->iterator, language, state);
 }
 
 MOONBIT_FFI_EXPORT
 const TSLanguage *
 moonbit_ts_lookahead_iterator_language(MoonBitTSLookaheadIterator *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_lookahead_iterator_language(self->iterator);
 }
 
 MOONBIT_FFI_EXPORT
 int32_t
 moonbit_ts_lookahead_iterator_next(MoonBitTSLookaheadIterator *self) {
+  MOONBIT_TS_STATS_CALL();
   return ts_lookahead_iterator_next(self->iterator);
 }
 
@@ -1568,6 +5252,7 @@ TSSymbol
 moonbit_ts_lookahead_iterator_current_symbol(
   const MoonBitTSLookaheadIterator *self
 ) {
+  MOONBIT_TS_STATS_CALL();
   return ts_lookahead_iterator_current_symbol(self->iterator);
 }
 
@@ -1576,5 +5261,53 @@ const char *
 moonbit_ts_lookahead_iterator_current_symbol_name(
   const MoonBitTSLookaheadIterator *self
 ) {
+  MOONBIT_TS_STATS_CALL();
   return ts_lookahead_iterator_current_symbol_name(self->iterator);
 }
+
+MOONBIT_FFI_EXPORT
+int32_t
+moonbit_ts_stats_enabled(void) {
+#ifdef MOONBIT_TS_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Snapshot the instrumentation counters as lines of
+// `<kind>\t<function>\t<line>\t<count>\n`, resetting them if `reset` is set.
+// Counters that are zero are not listed.
+MOONBIT_FFI_EXPORT
+moonbit_bytes_t
+moonbit_ts_stats_snapshot(int32_t reset) {
+#ifdef MOONBIT_TS_STATS
+  MoonBitTSCounter *head = moonbit_ts_counters_head();
+  size_t length = 0;
+  for (MoonBitTSCounter *counter = head; counter; counter = counter->next) {
+    length += (size_t)snprintf(
+      NULL, 0, "%s\t%s\t%d\t%" PRIu64 "\n", counter->kind, counter->function,
+      counter->line, UINT64_MAX
+    );
+  }
+  char *buffer = (char *)malloc(length + 1);
+  size_t written = 0;
+  for (MoonBitTSCounter *counter = head; counter; counter = counter->next) {
+    uint64_t count = moonbit_ts_counter_take(counter, reset);
+    if (count == 0) {
+      continue;
+    }
+    written += (size_t)snprintf(
+      buffer + written, length + 1 - written, "%s\t%s\t%d\t%" PRIu64 "\n",
+      counter->kind, counter->function, counter->line, count
+    );
+  }
+  moonbit_bytes_t bytes = moonbit_make_bytes_sz(written, 0);
+  memcpy(bytes, buffer, written);
+  free(buffer);
+  return bytes;
+#else
+  moonbit_ts_ignore(reset);
+  return moonbit_make_bytes(0, 0);
+#endif
+}